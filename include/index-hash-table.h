@@ -61,6 +61,106 @@ typedef struct { uint64_t v0, v1 ; } IhtCacheFastKey ;
  */
 typedef struct { uint64_t v0, v1 ; } IhtCacheFastValue ;
 
+/**
+ * @struct IhtCacheWideKey
+ * @brief Wide key structure, for 32-byte keys (e.g. four doubles).
+ *
+ * Caches with 32-byte keys hash and compare keys as a single 256-bit vector.
+ * @var v0 First 64-bit component
+ * @var v1 Second 64-bit component
+ * @var v2 Third 64-bit component
+ * @var v3 Fourth 64-bit component
+ */
+typedef struct { uint64_t v0, v1, v2, v3 ; } IhtCacheWideKey ;
+
+/**
+ * @struct IhtCacheWideValue
+ * @brief Wide value structure, for values of up to 32 bytes.
+ * @var v0 First 64-bit component
+ * @var v1 Second 64-bit component
+ * @var v2 Third 64-bit component
+ * @var v3 Fourth 64-bit component
+ */
+typedef struct { uint64_t v0, v1, v2, v3 ; } IhtCacheWideValue ;
+
+/**
+ * @enum IhtProbeMode
+ * @brief Probing strategy used to search the hash table.
+ *
+ * @var IHT_PROBE_LINEAR Scalar linear probing, one slot at a time (default).
+ * @var IHT_PROBE_GROUP Linear probing that compares 16 (SSE2), 32 (AVX2) or 64 (AVX-512) slot tags
+ *      at a time, touching the entries only for candidate matches. Suited for
+ *      load factors above the default.
+ * @var IHT_PROBE_ROBIN_HOOD Linear probing with Robin Hood insertion: entries are kept
+ *      ordered by distance from their home slot, which bounds the variance of probe
+ *      lengths, and lets lookups for missing keys stop early. Evictions use backward
+ *      shift deletion. Suited for load factors of 0.85 and above.
+ */
+typedef enum { IHT_PROBE_LINEAR = 0, IHT_PROBE_GROUP = 1, IHT_PROBE_ROBIN_HOOD = 2 } IhtProbeMode ;
+
+/**
+ * @enum IhtLayout
+ * @brief Storage layout for cache items.
+ *
+ * @var IHT_LAYOUT_INDIRECT Items are allocated from a separate pool, and each hash slot
+ *      holds the item index (default). Uses the least memory.
+ * @var IHT_LAYOUT_INLINE For fast mode caches (key and value up to 16 bytes), the
+ *      key/value pair is stored at the hash slot position, so a hit is a single
+ *      item access without the index indirection. Uses 1/max_load_factor times more
+ *      item memory. Ignored for caches that are not in fast mode.
+ */
+typedef enum { IHT_LAYOUT_INDIRECT = 0, IHT_LAYOUT_INLINE = 1 } IhtLayout ;
+
+/**
+ * @enum IhtEvictionPolicy
+ * @brief How the victim is chosen when a full cache adds an entry.
+ *
+ * @var IHT_EVICT_CLOCK Aging CLOCK over the hash slots: hits raise the slot age, the
+ *      eviction scan lowers it, and the youngest slot of a short window is evicted
+ *      (default). Needs no memory beyond the slot control bytes.
+ * @var IHT_EVICT_SIEVE SIEVE: entries are kept in insertion order, hits only mark
+ *      the entry as visited. A hand moves from the oldest entry toward the newest,
+ *      clearing visited marks, and evicts the first unvisited entry. Resists scans.
+ * @var IHT_EVICT_S3FIFO S3-FIFO: new entries go to a small FIFO queue (10% of the
+ *      items), and move to the main queue if they are hit before they reach its
+ *      end. Entries evicted from the small queue are remembered in a ghost table,
+ *      and go directly to the main queue when they are added again. Suited for
+ *      skewed (Zipfian) access with many one-hit entries.
+ * @var IHT_EVICT_SAMPLED_LRU Approximate LRU: the least recently used of 8 random
+ *      entries is evicted. Adapts quickly when the working set drifts.
+ * @var IHT_EVICT_GREEDY_DUAL Cost aware GreedyDual: each filler call is timed (TSC
+ *      cycles), and the entry keeps its cost class (a power of 2). Each entry has a
+ *      priority H = L + cost, set when it is added or hit, the entry with the lowest
+ *      priority is evicted (kept in a heap), and L is raised to the priority of the
+ *      victim. Expensive values survive longer, to reduce the total filler time
+ *      rather than the number of misses. Entries added with ihtCachePut() get the
+ *      average filler cost. The heap takes 16 more bytes per item.
+ *
+ * Policies other than IHT_EVICT_CLOCK keep per-item metadata (32 bytes per item),
+ * and use the IHT_LAYOUT_INDIRECT layout.
+ */
+typedef enum {
+    IHT_EVICT_CLOCK = 0, IHT_EVICT_SIEVE = 1, IHT_EVICT_S3FIFO = 2, IHT_EVICT_SAMPLED_LRU = 3, IHT_EVICT_GREEDY_DUAL = 4
+} IhtEvictionPolicy ;
+
+/**
+ * @enum IhtAdmission
+ * @brief Which filled values are added to a full cache.
+ *
+ * @var IHT_ADMIT_ALL Every value computed by the filler is added, evicting a victim
+ *      when the cache is full (default).
+ * @var IHT_ADMIT_TINYLFU TinyLFU: the access frequency of keys is estimated with a
+ *      count-min sketch of 4-bit counters, behind a doorkeeper bloom filter that
+ *      absorbs keys seen only once. The counters are halved periodically, so the
+ *      estimates follow recent history. When the cache is full, a new key is
+ *      added only if its estimate is higher than the estimate of the victim.
+ *      A rejected value is returned to the caller, but not cached: pointers
+ *      returned by ihtCacheGet() for it are valid until the next rejected key.
+ *      Uses 3 to 5 bytes per item. Values stored with ihtCachePut() are always
+ *      added.
+ */
+typedef enum { IHT_ADMIT_ALL = 0, IHT_ADMIT_TINYLFU = 1 } IhtAdmission ;
+
 /**
  * @typedef ihtCacheCxtDestroyer
  * @brief Callback function for destroying the cache context.
@@ -86,6 +186,19 @@ typedef void (*ihtCacheValueDestroyer)(void *cxt, void *value) ;
  */
 typedef bool (*ihtCacheFiller)(void *cxt, const void *key, void *value_out);
 
+/**
+ * @typedef ihtCacheBatchFiller
+ * @brief Callback function filling the missing entries of a batched get at once,
+ *        see ihtCacheSetBatchFiller().
+ * @param cxt The context pointer (the one of the filler).
+ * @param keys Array of n keys, each key_size bytes.
+ * @param n Number of keys, at least 1.
+ * @param values_out Array of n values, each value_size bytes, to write the values to.
+ * @param ok_mask Bit mask of (n+63)/64 words, cleared by the cache. The filler sets
+ *        bit i if value i was filled.
+ */
+typedef void (*ihtCacheBatchFiller)(void *cxt, const void *keys, int n, void *values_out, uint64_t *ok_mask);
+
 /**
  * @brief Create and initialize a new index hash table cache.
  * 
@@ -100,8 +213,27 @@ typedef bool (*ihtCacheFiller)(void *cxt, const void *key, void *value_out);
  * @return A new IhtCache instance, or NULL if memory allocation fails.
  */
 IhtCache ihtCacheCreate(int min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt);
+
+/**
+ * @brief Create a cache with a 64-bit capacity.
+ *
+ * Same as ihtCacheCreate(), for caches that may hold more than INT_MAX items.
+ * Tables with more than INT32_MAX slots use 64-bit hashes and 16-byte entries,
+ * smaller tables keep the compact 8-byte entries.
+ *
+ * @see ihtCacheCreate()
+ */
+IhtCache ihtCacheCreate64(int64_t min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt);
+
 /**
  * @brief Remove all entries from the cache, resetting it to an empty state.
+ *
+ * Runs in constant time: the cache epoch is bumped, and entries of the previous
+ * epoch become invisible. Their slots are reclaimed lazily by the following inserts,
+ * and the value destroyer (if set) is invoked for those values at that point.
+ * Calling again before the previous epoch is fully reclaimed completes that
+ * cleanup first.
+ *
  * @param cache The cache to clear.
  */
 void ihtCacheRemoveAll(IhtCache cache) ;
@@ -134,6 +266,18 @@ bool ihtCacheFetch(IhtCache cache, const void *key, void *value_out) ;
  */
 bool ihtCachePut(IhtCache cache, const void *key, const void *value) ;
 
+/**
+ * @brief Remove a key from the cache.
+ *
+ * The value destroyer (if set) is invoked for the removed value. The following
+ * entries of the probe chain are shifted back, so no tombstones are left behind.
+ *
+ * @param cache The cache instance.
+ * @param key Pointer to the key to remove.
+ * @return true if the key was found and removed, false otherwise.
+ */
+bool ihtCacheRemove(IhtCache cache, const void *key) ;
+
 /**
  * @brief Look up a value in the cache without invoking the filler callback.
  * @param cache The cache instance.
@@ -168,11 +312,155 @@ void *ihtCacheGet(IhtCache cache, const void *key) ;
  */
 IhtCacheFastValue ihtCacheGet_Fast(IhtCache cache, IhtCacheFastKey key) ;
 
+/**
+ * @brief Fast lookup for wide mode caches (32-byte keys, values up to 32 bytes).
+ *
+ * The wide mode counterpart of ihtCacheGet_Fast(). Items are stored as one
+ * 64-byte cache line, the key is compared with a single 256-bit vector compare,
+ * and the value is returned with one 256-bit copy. Values smaller than 32 bytes
+ * are zero padded.
+ *
+ * @param cache The cache instance, created with a key size of 32 bytes.
+ * @param key The WIDE key structure to look up.
+ * @return The WIDE value associated with the key, or the NA value if not found.
+ */
+IhtCacheWideValue ihtCacheGet_Wide(IhtCache cache, IhtCacheWideKey key) ;
+
+/**
+ * @brief Fetch a batch of values from the cache, invoking the filler callback if needed.
+ *
+ * Equivalent to calling ihtCacheFetch() for each key, but hashes the keys and
+ * prefetches the table memory for several keys at a time, so the memory accesses
+ * of different keys overlap. Keys not found are filled in order, or with a batch
+ * filler (see ihtCacheSetBatchFiller()), all together after the lookups.
+ *
+ * @param cache The cache instance.
+ * @param n Number of keys.
+ * @param keys Array of n keys, each key_size bytes.
+ * @param values_out Array of n values (each value_size bytes) to write the results to.
+ *        Values that are not available are set to the NA value.
+ * @param miss_mask Optional (may be NULL) bit mask of (n+63)/64 words. Bit i is set
+ *        if no value was available for key i.
+ * @return The number of keys for which no value was available.
+ */
+int ihtCacheGetBatch(IhtCache cache, int n, const void *keys, void *values_out, uint64_t *miss_mask) ;
+
+/**
+ * @brief Batched version of ihtCacheGet_Fast().
+ *
+ * See ihtCacheGetBatch(). The batch filler gets the keys and values packed, with
+ * key_size and value_size bytes each, not as FAST keys and values.
+ *
+ * @param cache The cache instance.
+ * @param n Number of keys.
+ * @param keys Array of n FAST keys.
+ * @param values_out Array of n FAST values. Values that are not available are set to the NA value.
+ * @param miss_mask Optional (may be NULL) bit mask of (n+63)/64 words. Bit i is set
+ *        if no value was available for key i.
+ * @return The number of keys for which no value was available.
+ */
+int ihtCacheGetBatch_Fast(IhtCache cache, int n, const IhtCacheFastKey *keys, IhtCacheFastValue *values_out, uint64_t *miss_mask) ;
+
+/**
+ * @struct iht_cache_view
+ * @brief Part of the cache state exposed for the inline hit path (IHT_INLINE_FAST_PATH).
+ *
+ * Placed at the start of the cache structure, and kept up to date by the library.
+ * Not part of the stable API: applications should not access it directly.
+ * @var states Control bytes, or NULL when inline hits are not possible (the cache is not
+ *      in fast mode with IHT_LAYOUT_INLINE, or a resize is being migrated).
+ * @var items Fast mode items, stored at their slot index.
+ * @var slot_mask Number of slots - 1.
+ * @var inline_hits Number of hits served by the inline path, included in the statistics.
+ * @var tag_shift Position of the control byte tag in the hash.
+ * @var epoch Current epoch bit of the control bytes.
+ * @var hash_kind Hash function used by the library build (IhtViewHash).
+ * @var count_hits Count inline hits (statistics mode IHT_STATS_FULL).
+ */
+typedef enum { IHT_VIEW_HASH_MUL = 0, IHT_VIEW_HASH_CRC = 1, IHT_VIEW_HASH_WIDE = 2 } IhtViewHash ;
+
+struct iht_cache_view {
+    unsigned char *states ;
+    struct iht_view_item { IhtCacheFastKey key ; IhtCacheFastValue value ; } *items ;
+    uint64_t slot_mask ;
+    int64_t inline_hits ;
+    int tag_shift ;
+    unsigned char epoch ;
+    unsigned char hash_kind ;
+    bool count_hits ;
+} ;
+
+#if defined(IHT_INLINE_FAST_PATH)
+// The fmix64 finalizer of the library's wide hash
+static inline uint64_t iht_view_mix64(uint64_t h)
+{
+    h ^= h >> 33 ;
+    h *= 0xff51afd7ed558ccdULL ;
+    h ^= h >> 33 ;
+    h *= 0xc4ceb9fe1a85ec53ULL ;
+    h ^= h >> 33 ;
+    return h ;
+}
+
+/**
+ * @brief ihtCacheGet_Fast() with the hit path inlined into the caller.
+ *
+ * Defined when IHT_INLINE_FAST_PATH is defined before including this header. A key
+ * found at its home slot of a fast mode cache with IHT_LAYOUT_INLINE is returned
+ * without a call. Anything else (other slots, misses, other layouts, a pending resize)
+ * calls ihtCacheGet_Fast(). The CRC hash needs the caller to be compiled with SSE4.2
+ * when the library uses it, otherwise all lookups go through ihtCacheGet_Fast().
+ *
+ * @param cache The cache instance.
+ * @param key The FAST key structure to look up.
+ * @return The FAST value associated with the key, or the NA value if not found.
+ */
+static inline IhtCacheFastValue ihtCacheGet_FastInline(IhtCache cache, IhtCacheFastKey key)
+{
+    struct iht_cache_view *view = (struct iht_cache_view *) cache ;
+    if ( view->states ) {
+        uint64_t hash ;
+        switch ( view->hash_kind ) {
+            case IHT_VIEW_HASH_MUL:
+                hash = (key.v0 ^ (key.v1 + 0x9e3779b97f4a7c15ULL)) * 0x9e3779b97f4a7c15ULL ;
+                hash ^= hash >> 32 ;
+                hash ^= hash >> 16 ;
+                hash = (uint32_t) hash ;
+                break ;
+#if defined(__SSE4_2__)
+            case IHT_VIEW_HASH_CRC:
+                hash = (uint32_t) __builtin_ia32_crc32di(__builtin_ia32_crc32di(0x9e377989, key.v0), key.v1) ;
+                break ;
+#endif
+            case IHT_VIEW_HASH_WIDE:
+                hash = iht_view_mix64(key.v0 ^ iht_view_mix64(key.v1 + 0x9e3779b97f4a7c15ULL)) ;
+                break ;
+            default:
+                return ihtCacheGet_Fast(cache, key) ;
+        }
+        uint64_t slot = hash & view->slot_mask ;
+        unsigned char state = view->states[slot] ;
+        unsigned char tag = (unsigned char) ((hash >> view->tag_shift) & 0xF0) ;
+        // Tag and epoch match, and the slot holds a value (age above 1)
+        if ( (state & 0xF8) == (tag | view->epoch) && (state & 0x07) > 1 ) {
+            const struct iht_view_item *item = &view->items[slot] ;
+            if ( ((item->key.v0 ^ key.v0) | (item->key.v1 ^ key.v1)) == 0 ) {
+                if ( (state & 0x07) < 7 ) view->states[slot] = state + 1 ;
+                if ( view->count_hits ) view->inline_hits++ ;
+                return item->value ;
+            }
+        }
+    }
+    return ihtCacheGet_Fast(cache, key) ;
+}
+#endif
+
 /**
  * @brief Specialized fast lookup for double-precision floating point keys and values.
  * 
  * Optimized for caches with double keys and values, leveraging register passing
- * on x86_64 architecture.
+ * on x86_64 architecture. Uses ihtCacheGet_FastInline() when IHT_INLINE_FAST_PATH
+ * is defined.
  * 
  * @param cache The cache instance.
  * @param key The double key value to look up.
@@ -186,7 +474,11 @@ static inline double ihtCacheGet_D_D(IhtCache cache, double key)
         IhtCacheFastValue v ;
     } ;
     union fast_double fast_k = { .d = key } ;
+#if defined(IHT_INLINE_FAST_PATH)
+    union fast_double fast_v = { .v = ihtCacheGet_FastInline(cache, fast_k.k) } ;
+#else
     union fast_double fast_v = { .v = ihtCacheGet_Fast(cache, fast_k.k) } ;
+#endif
     return fast_v.d ;
 }
 
@@ -197,6 +489,27 @@ static inline double ihtCacheGet_D_D(IhtCache cache, double key)
  */
 bool ihtCacheHasFiller(IhtCache cache) ;
 
+/**
+ * @brief Set the batch filler, used by ihtCacheGetBatch() and ihtCacheGetBatch_Fast().
+ *
+ * With a batch filler, a batched get looks up all the keys first, then fills the
+ * keys not found with one call of the batch filler, and adds the values. Fillers
+ * computing several values together (SIMD) avoid the per-key calls of the filler.
+ * The adaptive bypass does not apply to these gets. Single key gets still use the
+ * filler.
+ *
+ * @param cache The cache instance.
+ * @param batch_filler The batch filler, NULL to fill batched gets with the filler.
+ */
+void ihtCacheSetBatchFiller(IhtCache cache, ihtCacheBatchFiller batch_filler) ;
+
+/**
+ * @brief Get the batch filler.
+ * @param cache The cache instance.
+ * @return The batch filler, NULL if not set.
+ */
+ihtCacheBatchFiller ihtCacheGetBatchFiller(IhtCache cache) ;
+
 /**
  * @brief Get the current number of items in the cache's item pool.
  * @param cache The cache instance.
@@ -204,6 +517,13 @@ bool ihtCacheHasFiller(IhtCache cache) ;
  */
 int ihtCacheGetItemCount(IhtCache cache) ;
 
+/**
+ * @brief Get the current number of items, for caches with a 64-bit capacity.
+ * @param cache The cache instance.
+ * @return The current item count.
+ */
+int64_t ihtCacheGetItemCount64(IhtCache cache) ;
+
 /**
  * @brief Get the maximum capacity of the cache's item pool.
  * @param cache The cache instance.
@@ -211,6 +531,13 @@ int ihtCacheGetItemCount(IhtCache cache) ;
  */
 int ihtCacheGetMaxItems(IhtCache cache) ;
 
+/**
+ * @brief Get the maximum number of items, for caches with a 64-bit capacity.
+ * @param cache The cache instance.
+ * @return The maximum number of items.
+ */
+int64_t ihtCacheGetMaxItems64(IhtCache cache) ;
+
 /**
  * @brief Get the size in bytes of cache keys.
  * @param cache The cache instance.
@@ -250,6 +577,31 @@ void ihtCacheSetMaxLoadFactor(IhtCache cache, double max_load_factor) ;
  */
 void ihtCacheSetMinCapacity(IhtCache cache, int min_capacity) ;
 
+/**
+ * @brief Set a 64-bit minimum capacity for the cache.
+ * @param cache The cache instance.
+ * @param min_capacity The minimum number of entries the cache should hold.
+ */
+void ihtCacheSetMinCapacity64(IhtCache cache, int64_t min_capacity) ;
+
+/**
+ * @brief Use 64-bit hashes and wide entries, regardless of the table size.
+ *
+ * Wide entries are selected automatically for tables with more than INT32_MAX
+ * slots. Takes effect on the next call to ihtCacheReconfigure().
+ *
+ * @param cache The cache instance.
+ * @param wide true to force wide entries.
+ */
+void ihtCacheSetWideIndex(IhtCache cache, bool wide) ;
+
+/**
+ * @brief Check if the cache uses 64-bit hashes and wide entries.
+ * @param cache The cache instance.
+ * @return true if the current table uses wide entries.
+ */
+bool ihtCacheGetWideIndex(IhtCache cache) ;
+
 /**
  * @brief Set the context destroyer callback function.
  * 
@@ -279,6 +631,100 @@ void ihtCacheSetValueDestroyer(IhtCache cache, ihtCacheValueDestroyer value_dest
  */
 void ihtCacheSetNAValue(IhtCache cache, const void *na_value) ;
 
+/**
+ * @brief Set the probing strategy for the cache.
+ *
+ * Takes effect on the next call to ihtCacheReconfigure().
+ *
+ * @param cache The cache instance.
+ * @param probe_mode The probing strategy.
+ */
+void ihtCacheSetProbeMode(IhtCache cache, IhtProbeMode probe_mode) ;
+
+/**
+ * @brief Get the probing strategy for the cache.
+ * @param cache The cache instance.
+ * @return The probing strategy.
+ */
+IhtProbeMode ihtCacheGetProbeMode(IhtCache cache) ;
+
+/**
+ * @brief Set the storage layout for the cache items.
+ *
+ * Takes effect on the next call to ihtCacheReconfigure().
+ *
+ * @param cache The cache instance.
+ * @param layout The storage layout.
+ */
+void ihtCacheSetLayout(IhtCache cache, IhtLayout layout) ;
+
+/**
+ * @brief Get the storage layout for the cache items.
+ * @param cache The cache instance.
+ * @return The configured storage layout.
+ */
+IhtLayout ihtCacheGetLayout(IhtCache cache) ;
+
+/**
+ * @brief Set the eviction policy for the cache.
+ *
+ * Takes effect on the next call to ihtCacheReconfigure() or ihtCacheResize().
+ *
+ * @param cache The cache instance.
+ * @param policy The eviction policy.
+ */
+void ihtCacheSetEvictionPolicy(IhtCache cache, IhtEvictionPolicy policy) ;
+
+/**
+ * @brief Get the eviction policy for the cache.
+ * @param cache The cache instance.
+ * @return The configured eviction policy.
+ */
+IhtEvictionPolicy ihtCacheGetEvictionPolicy(IhtCache cache) ;
+
+/**
+ * @brief Set the admission filter for filled values.
+ *
+ * Takes effect on the next call to ihtCacheReconfigure() or ihtCacheResize(),
+ * which start with empty frequency estimates.
+ *
+ * @param cache The cache instance.
+ * @param admission The admission filter.
+ */
+void ihtCacheSetAdmission(IhtCache cache, IhtAdmission admission) ;
+
+/**
+ * @brief Get the admission filter for filled values.
+ * @param cache The cache instance.
+ * @return The configured admission filter.
+ */
+IhtAdmission ihtCacheGetAdmission(IhtCache cache) ;
+
+/**
+ * @brief Enable or disable the adaptive bypass.
+ *
+ * With the adaptive bypass, the cache times a short window of lookups every
+ * 64K lookups: hits, misses with their insert, and the filler calls. When the
+ * measured cost of going through the cache is higher than calling the filler,
+ * the following lookups of the Get and Fetch functions call the filler directly,
+ * without looking up or inserting the key (pass through), until the next window.
+ * Consecutive pass through periods get longer, up to 4M lookups. The value of a
+ * passed key is held like a value rejected by the admission filter (see
+ * IHT_ADMIT_TINYLFU). Lookups, puts and removes always use the cache.
+ * Takes effect immediately.
+ *
+ * @param cache The cache instance.
+ * @param enabled True to enable the adaptive bypass.
+ */
+void ihtCacheSetAdaptiveBypass(IhtCache cache, bool enabled) ;
+
+/**
+ * @brief Check if the adaptive bypass is enabled.
+ * @param cache The cache instance.
+ * @return True if the adaptive bypass is enabled.
+ */
+bool ihtCacheGetAdaptiveBypass(IhtCache cache) ;
+
 /**
  * @brief Reconfigure the cache based on updated settings.
  * 
@@ -289,6 +735,122 @@ void ihtCacheSetNAValue(IhtCache cache, const void *na_value) ;
  */
 void ihtCacheReconfigure(IhtCache cache) ;
 
+/**
+ * @brief Resize the cache based on updated settings, keeping its content.
+ *
+ * Like ihtCacheReconfigure(), but existing entries are kept. A new table is
+ * allocated, and the entries of the old table are migrated incrementally: each
+ * lookup moves a small number of old slots, and a key found only in the old table
+ * is moved when it is looked up. When the cache shrinks, entries that do not fit
+ * are evicted during the migration. A pending migration is completed before a
+ * new resize starts.
+ *
+ * @param cache The cache instance.
+ */
+void ihtCacheResize(IhtCache cache) ;
+
+/**
+ * @enum IhtStatsMode
+ * @brief How operations are counted in the cache statistics.
+ *
+ * @var IHT_STATS_FULL Every operation updates the cache counters (default).
+ * @var IHT_STATS_SAMPLED One operation in sample_rate of the cache is counted, with
+ *      weight sample_rate. Counts are estimates.
+ * @var IHT_STATS_PER_THREAD Each thread counts in its own cache line, the lines are
+ *      summed when the statistics are read. Inline hits are not counted.
+ * @var IHT_STATS_NONE No counting. This is the only mode when the library is built
+ *      with IHT_NO_STATS (cmake -DIHT_STATS=OFF).
+ */
+typedef enum { IHT_STATS_FULL = 0, IHT_STATS_SAMPLED = 1, IHT_STATS_PER_THREAD = 2, IHT_STATS_NONE = 3 } IhtStatsMode ;
+
+/** @brief Number of buckets of the probe length histograms. */
+#define IHT_PROBE_BUCKETS 16
+
+/** @brief Number of CLOCK ages in the victim age distribution. */
+#define IHT_VICTIM_AGES 6
+
+/**
+ * @struct IhtCacheCounter
+ * @brief Operation counter, with the probe lengths of the operations.
+ * @var count Number of operations.
+ * @var scans Total number of slots scanned beyond the home slot.
+ * @var probe_hist Probe length histogram: bucket 0 counts operations with no scans,
+ *      bucket b counts scans in [2^(b-1), 2^b). The last bucket is open ended.
+ */
+typedef struct {
+    int64_t count ;
+    int64_t scans ;
+    int64_t probe_hist[IHT_PROBE_BUCKETS] ;
+} IhtCacheCounter ;
+
+/**
+ * @struct IhtCacheStats
+ * @brief Snapshot of the cache statistics, see ihtCacheGetStats().
+ * @var mode Statistics mode the counters were collected in.
+ * @var policy Eviction policy in use.
+ * @var lookups Number of lookups (hits + misses).
+ * @var hits Lookups that found the key, including inline hits.
+ * @var misses Lookups that did not find the key.
+ * @var adds Entries added.
+ * @var updates Puts of keys already in the cache.
+ * @var evictions Entries evicted, with the slots scanned to find the victim.
+ * @var removes Entries removed with ihtCacheRemove().
+ * @var rejects Filled values not added to the cache by the admission filter.
+ * @var fill_cycles Time spent in the filler, in TSC cycles. Only measured with
+ *      IHT_EVICT_GREEDY_DUAL, and in the timed windows of the adaptive bypass.
+ * @var passes Lookups passed to the filler by the adaptive bypass.
+ * @var passing True if the adaptive bypass currently passes lookups to the filler.
+ * @var shared_fills Misses that waited for the fill of the same key by another
+ *      thread instead of calling the filler (IhtAtomicCache). Included in misses.
+ * @var inline_hits Hits served by ihtCacheGet_FastInline(), with no probe length.
+ * @var victim_ages Evictions by CLOCK age of the victim: 0 for entries not used since
+ *      they were added (or aged back), up to IHT_VICTIM_AGES-1 for the most used.
+ *      Only counted with IHT_EVICT_CLOCK.
+ */
+struct IhtCacheStats {
+    IhtStatsMode mode ;
+    IhtEvictionPolicy policy ;
+    int64_t lookups ;
+    IhtCacheCounter hits ;
+    IhtCacheCounter misses ;
+    IhtCacheCounter adds ;
+    IhtCacheCounter updates ;
+    IhtCacheCounter evictions ;
+    IhtCacheCounter removes ;
+    int64_t rejects ;
+    int64_t fill_cycles ;
+    int64_t passes ;
+    bool passing ;
+    int64_t shared_fills ;
+    int64_t inline_hits ;
+    int64_t victim_ages[IHT_VICTIM_AGES] ;
+} ;
+
+/**
+ * @brief Set the statistics mode. Takes effect immediately, counters are kept.
+ * @param cache The cache instance.
+ * @param mode The statistics mode.
+ * @param sample_rate For IHT_STATS_SAMPLED, count one operation in sample_rate.
+ */
+void ihtCacheSetStatsMode(IhtCache cache, IhtStatsMode mode, int sample_rate) ;
+
+/**
+ * @brief Get the statistics mode.
+ * @param cache The cache instance.
+ * @return The statistics mode, IHT_STATS_NONE if statistics are compiled out.
+ */
+IhtStatsMode ihtCacheGetStatsMode(IhtCache cache) ;
+
+/**
+ * @brief Get a snapshot of the cache statistics.
+ *
+ * Per-thread counters are summed, and inline hits are included. Available in
+ * every statistics mode.
+ * @param cache The cache instance.
+ * @param out Structure to write the statistics to.
+ */
+void ihtCacheGetStats(IhtCache cache, struct IhtCacheStats *out) ;
+
 /**
  * @brief Clear all cache statistics counters.
  * @param cache The cache instance.
@@ -300,11 +862,266 @@ void ihtCacheClearStats(IhtCache cache) ;
  * @param fp File pointer to write statistics to.
  * @param cache The cache instance.
  * @param label A label string to prefix the statistics output with.
- * @param detail_level The level of detail to include in the output (0 = minimal, 1 = standard, 2 = full).
+ * @param detail_level The level of detail to include in the output (0 = minimal, 1 = standard, 2 = full,
+ *        3 = full with probe length histograms and victim ages).
  */
 void ihtCachePrintStats(FILE *fp, IhtCache cache, const char *label) ;
 void ihtCachePrintStats1(FILE *fp, IhtCache cache, const char *label, int indent, int show_stats) ;
 
+/**
+ * @typedef IhtShardedCache
+ * @brief Opaque pointer to a thread-safe cache, made of independent IhtCache shards.
+ *
+ * An IhtCache is not thread safe: even lookups update the CLOCK ages, the eviction
+ * policy and the statistics. A sharded cache routes each key to one of its shards by
+ * the high bits of a mixed key hash, and each shard is guarded by its own lock, so
+ * threads working on different shards do not wait for each other. Each shard keeps
+ * its own statistics, summed by ihtShardedCacheGetStats().
+ *
+ * The filler is called with the shard lock held, and may be called from several
+ * threads at once (for keys of different shards): it must be thread safe. All the
+ * operations on a shard wait for its running fill: threads spin for a short while,
+ * then sleep until the shard lock is released.
+ */
+typedef struct iht_sharded_cache *IhtShardedCache ;
+
+/** @brief Maximum number of shards of a sharded cache. */
+#define IHT_MAX_SHARDS 4096
+
+/**
+ * @brief Create a sharded cache.
+ *
+ * The capacity is divided evenly between the shards. Use more shards than threads
+ * (e.g. 4 per thread) to make lock contention rare.
+ * @param min_capacity Minimum total capacity, in items.
+ * @param n_shards Number of shards, rounded up to a power of 2 (at most IHT_MAX_SHARDS).
+ * @param key_size Size of the keys, in bytes.
+ * @param value_size Size of the values, in bytes.
+ * @param filler Callback computing the value of a missing key, may be NULL.
+ * @param cxt Context passed to the filler. It is not released by the cache.
+ * @return The new sharded cache.
+ */
+IhtShardedCache ihtShardedCacheCreate(int64_t min_capacity, int n_shards, int key_size, int value_size, ihtCacheFiller filler, void *cxt) ;
+
+/**
+ * @brief Destroy a sharded cache and all its shards.
+ * @param cache The sharded cache, not in use by other threads.
+ */
+void ihtShardedCacheDestroy(IhtShardedCache cache) ;
+
+/**
+ * @brief Get the number of shards.
+ * @param cache The sharded cache.
+ * @return The number of shards, a power of 2.
+ */
+int ihtShardedCacheGetShardCount(IhtShardedCache cache) ;
+
+/**
+ * @brief Get a shard, to configure it.
+ *
+ * Shards can be configured with the ihtCache setters (followed by ihtCacheReconfigure()
+ * or ihtCacheResize()) only while the cache is not in use by other threads. Shards must
+ * keep the key and value sizes of the sharded cache, and must not be destroyed.
+ * @param cache The sharded cache.
+ * @param shard Shard number, from 0 to ihtShardedCacheGetShardCount()-1.
+ * @return The shard.
+ */
+IhtCache ihtShardedCacheGetShard(IhtShardedCache cache, int shard) ;
+
+/**
+ * @brief Enable or disable optimistic (lock-free) reads.
+ *
+ * With optimistic reads, the fetch, lookup and get functions first look the key up
+ * without taking the shard lock, and validate the read against the shard sequence
+ * number, which every locked operation changes. A hit writes nothing shared, except
+ * a best-effort CLOCK age update that stops once the entry age is at its maximum, so
+ * read-mostly workloads scale without moving lock cache lines between cores. Misses,
+ * reads that keep conflicting with a writer, and shards with other eviction policies,
+ * TinyLFU admission, the adaptive bypass or a pending resize take the lock.
+ *
+ * Shard statistics are switched to IHT_STATS_PER_THREAD (unless IHT_STATS_NONE):
+ * optimistic hits are counted only in that mode. Call before the cache is shared.
+ * @param cache The sharded cache.
+ * @param enabled True to enable optimistic reads.
+ */
+void ihtShardedCacheSetOptimisticReads(IhtShardedCache cache, bool enabled) ;
+
+/**
+ * @brief Check if optimistic reads are enabled.
+ * @param cache The sharded cache.
+ * @return True if optimistic reads are enabled.
+ */
+bool ihtShardedCacheGetOptimisticReads(IhtShardedCache cache) ;
+
+/**
+ * @brief Thread-safe ihtCacheFetch(): copy the value of key, filled if missing.
+ * @param cache The sharded cache.
+ * @param key Pointer to the key.
+ * @param value_out Buffer for the value.
+ * @return true if the value was found or filled.
+ */
+bool ihtShardedCacheFetch(IhtShardedCache cache, const void *key, void *value_out) ;
+
+/**
+ * @brief Thread-safe ihtCacheGet_Fast(), for caches in fast mode.
+ * @param cache The sharded cache.
+ * @param key The key.
+ * @return The value, or the NA value of the shard if it cannot be filled.
+ */
+IhtCacheFastValue ihtShardedCacheGet_Fast(IhtShardedCache cache, IhtCacheFastKey key) ;
+
+/**
+ * @brief Thread-safe ihtCacheLookup(): copy the value of key, without calling the filler.
+ * @param cache The sharded cache.
+ * @param key Pointer to the key.
+ * @param value_out Buffer for the value.
+ * @return true if the key was found.
+ */
+bool ihtShardedCacheLookup(IhtShardedCache cache, const void *key, void *value_out) ;
+
+/**
+ * @brief Thread-safe ihtCachePut().
+ * @param cache The sharded cache.
+ * @param key Pointer to the key.
+ * @param value Pointer to the value.
+ * @return true if the value was stored.
+ */
+bool ihtShardedCachePut(IhtShardedCache cache, const void *key, const void *value) ;
+
+/**
+ * @brief Thread-safe ihtCacheRemove().
+ * @param cache The sharded cache.
+ * @param key Pointer to the key.
+ * @return true if the key was removed.
+ */
+bool ihtShardedCacheRemove(IhtShardedCache cache, const void *key) ;
+
+/**
+ * @brief Thread-safe ihtCacheRemoveAll(). Shards are cleared one at a time.
+ * @param cache The sharded cache.
+ */
+void ihtShardedCacheRemoveAll(IhtShardedCache cache) ;
+
+/**
+ * @brief Get the number of items in all shards.
+ * @param cache The sharded cache.
+ * @return The number of items.
+ */
+int64_t ihtShardedCacheGetItemCount(IhtShardedCache cache) ;
+
+/**
+ * @brief Get the statistics of all shards, summed.
+ * @param cache The sharded cache.
+ * @param out Structure to write the statistics to.
+ */
+void ihtShardedCacheGetStats(IhtShardedCache cache, struct IhtCacheStats *out) ;
+
+/**
+ * @brief Print the statistics of all shards, summed. See ihtCachePrintStats1().
+ */
+void ihtShardedCachePrintStats(FILE *fp, IhtShardedCache cache, const char *label, int indent, int show_stats) ;
+
+/**
+ * @typedef IhtAtomicCache
+ * @brief Opaque pointer to a lock-free cache of fast keys and values.
+ *
+ * A table of IhtCacheFastKey to IhtCacheFastValue that any number of threads can
+ * read and write at once, without locks. Slots are claimed with a compare and swap of
+ * a per-slot control word, values are read and written as single 16-byte atomic
+ * accesses (cmpxchg16b), and a reader never waits for a writer. Operations are
+ * linearizable, except that any key may be evicted at any time (a lookup may miss).
+ *
+ * Keys live in a bucket of 8 slots chosen by the hash, and a full bucket evicts one
+ * of its entries, with a second chance for the entries hit since the last eviction.
+ * Statistics are always counted per thread (see IHT_STATS_PER_THREAD).
+ *
+ * The filler is called without any lock, and must be thread safe. Concurrent fetches
+ * of a missing key call it once: the other fetches wait for its value (or failure),
+ * counted as shared fills. A fetch that finds its bucket in use by other threads
+ * calls the filler without caching the value.
+ */
+typedef struct iht_atomic_cache *IhtAtomicCache ;
+
+/**
+ * @brief Create a lock-free cache, for 16-byte keys and values.
+ * @param min_capacity Minimum capacity, in items.
+ * @param filler Callback computing the value of a missing key (key and value point
+ *      to an IhtCacheFastKey and an IhtCacheFastValue), may be NULL.
+ * @param cxt Context passed to the filler. It is not released by the cache.
+ * @return The new cache.
+ */
+IhtAtomicCache ihtAtomicCacheCreate(int64_t min_capacity, ihtCacheFiller filler, void *cxt) ;
+
+/**
+ * @brief Destroy a lock-free cache.
+ * @param cache The cache, not in use by other threads.
+ */
+void ihtAtomicCacheDestroy(IhtAtomicCache cache) ;
+
+/**
+ * @brief Get the value of key, filled and added if missing. While another thread
+ *      fills the key, waits for its value.
+ * @param cache The cache.
+ * @param key The key.
+ * @param value_out Where to store the value.
+ * @return true if the value was found or filled.
+ */
+bool ihtAtomicCacheFetch(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out) ;
+
+/**
+ * @brief Get the value of key, without calling the filler.
+ * @param cache The cache.
+ * @param key The key.
+ * @param value_out Where to store the value.
+ * @return true if the key was found.
+ */
+bool ihtAtomicCacheLookup(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out) ;
+
+/**
+ * @brief Add or update the value of key.
+ * @param cache The cache.
+ * @param key The key.
+ * @param value The value.
+ * @return true if the value was stored, false if every slot of the bucket was in use
+ *      by other threads.
+ */
+bool ihtAtomicCachePut(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue value) ;
+
+/**
+ * @brief Remove key.
+ * @param cache The cache.
+ * @param key The key.
+ * @return true if the key was removed.
+ */
+bool ihtAtomicCacheRemove(IhtAtomicCache cache, IhtCacheFastKey key) ;
+
+/**
+ * @brief Count the items, by scanning the table. The count is approximate while
+ *      other threads update the cache.
+ * @param cache The cache.
+ * @return The number of items.
+ */
+int64_t ihtAtomicCacheGetItemCount(IhtAtomicCache cache) ;
+
+/**
+ * @brief Get the number of slots.
+ * @param cache The cache.
+ * @return The maximum number of items.
+ */
+int64_t ihtAtomicCacheGetMaxItems(IhtAtomicCache cache) ;
+
+/**
+ * @brief Get the cache statistics, summed over the threads.
+ * @param cache The cache.
+ * @param out Structure to write the statistics to.
+ */
+void ihtAtomicCacheGetStats(IhtAtomicCache cache, struct IhtCacheStats *out) ;
+
+/**
+ * @brief Print the cache statistics. See ihtCachePrintStats1().
+ */
+void ihtAtomicCachePrintStats(FILE *fp, IhtAtomicCache cache, const char *label, int indent, int show_stats) ;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,86 @@
+#ifndef IHT_API_H
+#define IHT_API_H
+
+#include "index-hash-table.h"
+
+// The public API functions: X(return type, name, parameter list).
+// index-hash-table.c is compiled once per ISA level, exporting each function with the
+// level as suffix, and iht-dispatch.c binds the public names to one level at load time.
+// Functions added to index-hash-table.h must be listed here.
+#define IHT_API_FUNCTIONS(X) \
+    X(IhtCache, ihtCacheCreate, (int min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt)) \
+    X(IhtCache, ihtCacheCreate64, (int64_t min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt)) \
+    X(void, ihtCacheRemoveAll, (IhtCache cache)) \
+    X(void, ihtCacheDestroy, (IhtCache cache)) \
+    X(bool, ihtCacheFetch, (IhtCache cache, const void *key, void *value_out)) \
+    X(bool, ihtCachePut, (IhtCache cache, const void *key, const void *value)) \
+    X(bool, ihtCacheRemove, (IhtCache cache, const void *key)) \
+    X(bool, ihtCacheLookup, (IhtCache cache, const void *key, void *value_out)) \
+    X(void *, ihtCacheGet, (IhtCache cache, const void *key)) \
+    X(IhtCacheFastValue, ihtCacheGet_Fast, (IhtCache cache, IhtCacheFastKey key)) \
+    X(IhtCacheWideValue, ihtCacheGet_Wide, (IhtCache cache, IhtCacheWideKey key)) \
+    X(int, ihtCacheGetBatch, (IhtCache cache, int n, const void *keys, void *values_out, uint64_t *miss_mask)) \
+    X(int, ihtCacheGetBatch_Fast, (IhtCache cache, int n, const IhtCacheFastKey *keys, IhtCacheFastValue *values_out, uint64_t *miss_mask)) \
+    X(bool, ihtCacheHasFiller, (IhtCache cache)) \
+    X(void, ihtCacheSetBatchFiller, (IhtCache cache, ihtCacheBatchFiller batch_filler)) \
+    X(ihtCacheBatchFiller, ihtCacheGetBatchFiller, (IhtCache cache)) \
+    X(int, ihtCacheGetItemCount, (IhtCache cache)) \
+    X(int64_t, ihtCacheGetItemCount64, (IhtCache cache)) \
+    X(int, ihtCacheGetMaxItems, (IhtCache cache)) \
+    X(int64_t, ihtCacheGetMaxItems64, (IhtCache cache)) \
+    X(int, ihtCacheGetKeySize, (IhtCache cache)) \
+    X(int, ihtCacheGetValueSize, (IhtCache cache)) \
+    X(double, ihtCacheGetMaxLoadFactor, (IhtCache cache)) \
+    X(void, ihtCacheSetMaxLoadFactor, (IhtCache cache, double max_load_factor)) \
+    X(void, ihtCacheSetMinCapacity, (IhtCache cache, int min_capacity)) \
+    X(void, ihtCacheSetMinCapacity64, (IhtCache cache, int64_t min_capacity)) \
+    X(void, ihtCacheSetWideIndex, (IhtCache cache, bool wide)) \
+    X(bool, ihtCacheGetWideIndex, (IhtCache cache)) \
+    X(void, ihtCacheSetCxtDestroyer, (IhtCache cache, ihtCacheCxtDestroyer cxt_destroyer)) \
+    X(void, ihtCacheSetValueDestroyer, (IhtCache cache, ihtCacheValueDestroyer value_destroyer)) \
+    X(void, ihtCacheSetNAValue, (IhtCache cache, const void *na_value)) \
+    X(void, ihtCacheSetProbeMode, (IhtCache cache, IhtProbeMode probe_mode)) \
+    X(IhtProbeMode, ihtCacheGetProbeMode, (IhtCache cache)) \
+    X(void, ihtCacheSetLayout, (IhtCache cache, IhtLayout layout)) \
+    X(IhtLayout, ihtCacheGetLayout, (IhtCache cache)) \
+    X(void, ihtCacheSetEvictionPolicy, (IhtCache cache, IhtEvictionPolicy policy)) \
+    X(IhtEvictionPolicy, ihtCacheGetEvictionPolicy, (IhtCache cache)) \
+    X(void, ihtCacheSetAdmission, (IhtCache cache, IhtAdmission admission)) \
+    X(IhtAdmission, ihtCacheGetAdmission, (IhtCache cache)) \
+    X(void, ihtCacheSetAdaptiveBypass, (IhtCache cache, bool enabled)) \
+    X(bool, ihtCacheGetAdaptiveBypass, (IhtCache cache)) \
+    X(void, ihtCacheReconfigure, (IhtCache cache)) \
+    X(void, ihtCacheResize, (IhtCache cache)) \
+    X(void, ihtCacheClearStats, (IhtCache cache)) \
+    X(void, ihtCacheSetStatsMode, (IhtCache cache, IhtStatsMode mode, int sample_rate)) \
+    X(IhtStatsMode, ihtCacheGetStatsMode, (IhtCache cache)) \
+    X(void, ihtCacheGetStats, (IhtCache cache, struct IhtCacheStats *out)) \
+    X(void, ihtCachePrintStats, (FILE *fp, IhtCache cache, const char *label)) \
+    X(void, ihtCachePrintStats1, (FILE *fp, IhtCache cache, const char *label, int indent, int show_stats)) \
+    X(IhtShardedCache, ihtShardedCacheCreate, (int64_t min_capacity, int n_shards, int key_size, int value_size, ihtCacheFiller filler, void *cxt)) \
+    X(void, ihtShardedCacheDestroy, (IhtShardedCache cache)) \
+    X(int, ihtShardedCacheGetShardCount, (IhtShardedCache cache)) \
+    X(IhtCache, ihtShardedCacheGetShard, (IhtShardedCache cache, int shard)) \
+    X(void, ihtShardedCacheSetOptimisticReads, (IhtShardedCache cache, bool enabled)) \
+    X(bool, ihtShardedCacheGetOptimisticReads, (IhtShardedCache cache)) \
+    X(bool, ihtShardedCacheFetch, (IhtShardedCache cache, const void *key, void *value_out)) \
+    X(IhtCacheFastValue, ihtShardedCacheGet_Fast, (IhtShardedCache cache, IhtCacheFastKey key)) \
+    X(bool, ihtShardedCacheLookup, (IhtShardedCache cache, const void *key, void *value_out)) \
+    X(bool, ihtShardedCachePut, (IhtShardedCache cache, const void *key, const void *value)) \
+    X(bool, ihtShardedCacheRemove, (IhtShardedCache cache, const void *key)) \
+    X(void, ihtShardedCacheRemoveAll, (IhtShardedCache cache)) \
+    X(int64_t, ihtShardedCacheGetItemCount, (IhtShardedCache cache)) \
+    X(void, ihtShardedCacheGetStats, (IhtShardedCache cache, struct IhtCacheStats *out)) \
+    X(void, ihtShardedCachePrintStats, (FILE *fp, IhtShardedCache cache, const char *label, int indent, int show_stats)) \
+    X(IhtAtomicCache, ihtAtomicCacheCreate, (int64_t min_capacity, ihtCacheFiller filler, void *cxt)) \
+    X(void, ihtAtomicCacheDestroy, (IhtAtomicCache cache)) \
+    X(bool, ihtAtomicCacheFetch, (IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out)) \
+    X(bool, ihtAtomicCacheLookup, (IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out)) \
+    X(bool, ihtAtomicCachePut, (IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue value)) \
+    X(bool, ihtAtomicCacheRemove, (IhtAtomicCache cache, IhtCacheFastKey key)) \
+    X(int64_t, ihtAtomicCacheGetItemCount, (IhtAtomicCache cache)) \
+    X(int64_t, ihtAtomicCacheGetMaxItems, (IhtAtomicCache cache)) \
+    X(void, ihtAtomicCacheGetStats, (IhtAtomicCache cache, struct IhtCacheStats *out)) \
+    X(void, ihtAtomicCachePrintStats, (FILE *fp, IhtAtomicCache cache, const char *label, int indent, int show_stats))
+
+#endif
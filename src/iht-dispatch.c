@@ -0,0 +1,36 @@
+// Runtime CPU dispatch. index-hash-table.c is compiled for several ISA levels (see
+// CMakeLists.txt), and each public function is an ifunc, bound once by the dynamic
+// loader to the build for the highest level the CPU supports. All functions resolve
+// to the same level, so hashes and table layouts are consistent within a process.
+
+#include "index-hash-table.h"
+#include "iht-api.h"
+
+typedef enum { ISA_BASE, ISA_SSE42, ISA_AVX2, ISA_AVX512 } IhtIsa ;
+
+// Called from the ifunc resolvers, before constructors have run
+static IhtIsa select_isa(void)
+{
+    __builtin_cpu_init() ;
+    if ( __builtin_cpu_supports("x86-64-v4") ) return ISA_AVX512 ;
+    if ( __builtin_cpu_supports("x86-64-v3") ) return ISA_AVX2 ;
+    if ( __builtin_cpu_supports("x86-64-v2") ) return ISA_SSE42 ;
+    return ISA_BASE ;
+}
+
+#define IHT_DISPATCH(ret, name, params) \
+    ret name##_base params ; \
+    ret name##_sse42 params ; \
+    ret name##_avx2 params ; \
+    ret name##_avx512 params ; \
+    static __typeof__(&name##_base) resolve_##name(void) { \
+        switch ( select_isa() ) { \
+            case ISA_AVX512: return name##_avx512 ; \
+            case ISA_AVX2: return name##_avx2 ; \
+            case ISA_SSE42: return name##_sse42 ; \
+            default: return name##_base ; \
+        } \
+    } \
+    ret name params __attribute__((ifunc("resolve_" #name))) ;
+
+IHT_API_FUNCTIONS(IHT_DISPATCH)
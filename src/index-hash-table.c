@@ -1,19 +1,58 @@
 #include "index-hash-table.h"
 
+#if defined(IHT_ISA)
+// Built once per ISA level: export the API with the level as suffix (e.g.
+// ihtCacheGet_avx2). iht-dispatch.c selects the level at load time.
+#include "iht-api.h"
+#define IHT_ISA_LABEL(name, isa) IHT_ISA_LABEL1(name, isa)
+#define IHT_ISA_LABEL1(name, isa) #name "_" #isa
+#define IHT_ISA_RENAME(ret, name, params) ret name params __asm__(IHT_ISA_LABEL(name, IHT_ISA)) ;
+IHT_API_FUNCTIONS(IHT_ISA_RENAME)
+#endif
+
 #include <stddef.h>
 #include <stdalign.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
 
 
 #define MIN_CAPACITY 16
 #define DEFAULT_LOAD_FACTOR 0.40
 #define MAX_EVICTION_SEARCH 16
+#define LRU_SAMPLES 8                   // entries compared by IHT_EVICT_SAMPLED_LRU
+#define MAX_COST_CLASS 48               // GreedyDual cost classes, cost 2^(class-1) cycles
+#define FILL_COST_SMOOTHING 16          // weight of the filler cost moving average
+#define S3FIFO_SMALL_RATIO 0.10         // small queue share of the items
+#define S3FIFO_MAX_FREQ 3
+#define SKETCH_ROWS 4                   // TinyLFU count-min sketch depth
+#define SKETCH_MAX_COUNT 15             // 4-bit counters
+#define SKETCH_SAMPLE_RATIO 10          // accesses per item between sketch agings
+#define DOORKEEPER_BITS_PER_ITEM 4
+#define BYPASS_WINDOW 1024              // timed lookups of the adaptive bypass
+#define BYPASS_PERIOD 65536             // lookups between timed windows
+#define BYPASS_MAX_PERIOD (64*BYPASS_PERIOD)
+#define BYPASS_MARGIN 1.2               // pass through only if clearly cheaper than caching
+#define MIGRATE_STEP 8                  // old table slots migrated per lookup, after ihtCacheResize
+#define SWEEP_STEP 4                    // stale slots reclaimed per insert, after ihtCacheRemoveAll
+#define BATCH_STAGE 16                          // keys hashed and prefetched together
+#define SHARD_SPINS 64                  // spins on a busy shard lock before sleeping
+#define OPTIMISTIC_TRIES 4              // optimistic reads before taking the shard lock
+#define ATOMIC_BUCKET_SLOTS 8           // IhtAtomicCache slots per bucket, control words in one cache line
+#define ATOMIC_LOAD_FACTOR 0.75
+#define FILL_SPINS 256                  // spins waiting for the fill of another thread before sleeping
 
 #define KNUTH_GOLD_32 0x9e377989                 // Knuth 32-bit golden ratio
 #define KNUTH_GOLD_64 0x9e3779b97f4a7c15ULL      // Knuth 64-bit golden ratio
+#define FMIX_C1 0xff51afd7ed558ccdULL             // MurmurHash3 fmix64 constants
+#define FMIX_C2 0xc4ceb9fe1a85ec53ULL
 
 #define int_sizeof(x) (int) sizeof(x)
 
@@ -27,139 +66,488 @@
 
 typedef enum SLOT_STATE { SLOT_EMPTY = 0, SLOT_REMOVED = 1, SLOT_MIN_AGE = 2, SLOT_MAX_AGE = 7 } SlotState ;
 
+// Each states[] byte is a control byte: the low 3 bits hold the SlotState (CLOCK age),
+// bit 3 holds the epoch, the high 4 bits hold a tag taken from the top of the hash value.
+// The tag lets group probing filter candidates 16/32/64 slots at a time without touching
+// entries[]. A slot is used only if its epoch bit matches the cache epoch: flipping the
+// cache epoch removes all entries at once (see ihtCacheRemoveAll). Slots of the old epoch
+// are stale - empty for probing, but still holding a value until they are reclaimed.
+#define STATE_AGE_MASK 0x07
+#define STATE_EPOCH_BIT 0x08
+#define STATE_TAG_MASK 0xF0
+#define STATE_LIVE_MASK 0x06            // age bits that are set only for used slots
+
 // set to SLOT_MIN_AGEA+n to make it more LRU.
 static SlotState INITIAL_STATE = SLOT_MIN_AGE ; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
-static inline bool empty_slot(SlotState slot_state) {
-    return slot_state <= SLOT_REMOVED ;
+static inline SlotState slot_age(unsigned char state) {
+    return (SlotState) (state & STATE_AGE_MASK) ;
+}
+
+// True if the slot holds a value, from the current epoch or a stale one
+static inline bool value_slot(unsigned char state) {
+    return slot_age(state) > SLOT_REMOVED ;
+}
+
+static inline bool live_slot(unsigned char state, unsigned char epoch) {
+    return value_slot(state) && (state & STATE_EPOCH_BIT) == epoch ;
+}
+
+// Slot and item indexes, sizes and counts are 64-bit. Hash values are 32-bit for
+// compact tables, and 64-bit for wide tables (see setup), held in an IhtHash.
+typedef int64_t IhtIndex ;
+typedef uint64_t IhtHash ;
+
+#define COMPACT_TAG_SHIFT 24            // tag from bits 28-31 of a 32-bit hash
+#define WIDE_TAG_SHIFT 56               // tag from bits 60-63 of a 64-bit hash
+
+static inline unsigned char hash_tag(IhtHash hash_value, int tag_shift) {
+    return (unsigned char) ((hash_value >> tag_shift) & STATE_TAG_MASK) ;
 }
 
+// Group probing: compare a whole group of control bytes with one SIMD instruction.
+// The states[] array carries GROUP_WIDTH extra bytes mirroring the first GROUP_WIDTH
+// slots, so a group starting near the end of the table can be loaded without wrapping.
+#if defined(__AVX512BW__)
+#include <immintrin.h>
+#define GROUP_WIDTH 64
+typedef uint64_t GroupMask ;
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define GROUP_WIDTH 32
+typedef uint32_t GroupMask ;
+#else
+#include <emmintrin.h>
+#define GROUP_WIDTH 16
+typedef uint32_t GroupMask ;
+#endif
+
+// Entry encodings, chosen by setup() from the table size.
+typedef enum { ENTRY_NARROW, ENTRY_COMPACT, ENTRY_WIDE } EntryFormat ;
+
+#define NARROW_MAX_ENTRIES 65536
+
+// Key/value sizes with specialized code paths, see size_class()
+typedef enum { SIZE_ANY, SIZE_8, SIZE_16, SIZE_24, SIZE_32, SIZE_48, SIZE_64 } SizeClass ;
+
+// Narrow entry, 4 bytes, for tables up to NARROW_MAX_ENTRIES slots. The 16-bit hash
+// keeps the slot bits of the hash (so the home slot can be recovered), with the high
+// hash bits folded into the bits above the slot mask as a fingerprint.
+typedef struct iht_narrow_entry {
+    uint16_t hash_value ;
+    uint16_t item_index ;
+} *IhtNarrowEntry ;
+
+// Compact entry, 8 bytes. Used unless the table has more than INT32_MAX slots.
 typedef struct iht_entry {
     uint32_t hash_value ;  // cached hash value
-    int item_index ;
+    int32_t item_index ;
 //    SlotState state:8 ;
 } *IhtEntry ;
 
+// Wide entry, 16 bytes, for tables with 64-bit sizes.
+typedef struct iht_wide_entry {
+    uint64_t hash_value ;
+    int64_t item_index ;
+} *IhtWideEntry ;
+
 typedef struct iht_item {
     IhtCacheFastKey key ;
     IhtCacheFastValue value ;
 } *IhtItem ;
 
-typedef struct iht_counter { int count; int scans ; } IhtCounter ;
+// Wide mode item: 32-byte key and value, one cache line (items are 64-byte aligned).
+typedef struct iht_wide_item {
+    IhtCacheWideKey key ;
+    IhtCacheWideValue value ;
+} *IhtWideItem ;
+
+#define WIDE_ITEM_ALIGN 64
+
+// Key access used by the probe loops: generic (key_size bytes), fast (16 bytes) or wide
+// (32 bytes). Fixed at compile time for each API entry point.
+typedef enum { KEY_GENERIC, KEY_FAST, KEY_WIDE } KeyKind ;
+
+typedef IhtCacheCounter IhtCounter ;
+
+// Statistics counters. Lookups are counted as hits + misses.
+typedef enum { STAT_HITS, STAT_MISSES, STAT_ADDS, STAT_UPDATES, STAT_EVICTIONS, STAT_REMOVES, STAT_REJECTS, STAT_PASSES, STAT_SHARED_FILLS, STAT_KINDS } StatKind ;
 
 struct iht_stats {
-    int lookups ;
-    IhtCounter hits ;
-    IhtCounter misses ;
-    IhtCounter adds ;
-    IhtCounter updates ;
-    IhtCounter evictions ;
+    IhtCounter counters[STAT_KINDS] ;
+    int64_t victim_ages[IHT_VICTIM_AGES] ;  // evictions by victim age - SLOT_MIN_AGE
+    int64_t fill_cycles ;                   // measured filler time
+} ;
+_Static_assert(IHT_VICTIM_AGES == SLOT_MAX_AGE - SLOT_MIN_AGE + 1, "victim ages") ;
+
+// Per-thread statistics (IHT_STATS_PER_THREAD): each thread updates one stripe, on
+// its own cache line, and the stripes are summed by ihtCacheGetStats(). Threads are
+// assigned to stripes round robin, counts are approximate with more threads than
+// stripes.
+#define STATS_STRIPES 16
+struct iht_stats_stripe {
+    alignas(64) struct iht_stats stats ;
+} ;
+
+// Per-item metadata of the queue and LRU eviction policies, indexed by item index
+// (the item index of an entry does not change when slots are moved). Queues are
+// doubly linked lists: head is the newest entry, next points toward the tail.
+typedef enum { QUEUE_NONE, QUEUE_MAIN, QUEUE_SMALL, QUEUE_KINDS } QueueKind ;
+
+struct iht_policy_node {
+    IhtIndex prev ;             // GreedyDual: position in the heap
+    IhtIndex next ;
+    uint64_t priority ;         // sampled LRU: last use time, GreedyDual: H value
+    unsigned char queue ;       // QueueKind
+    unsigned char freq ;        // SIEVE visited bit, S3-FIFO hit count
+    unsigned char cost_class ;  // GreedyDual
+} ;
+
+struct iht_queue {
+    IhtIndex head ;
+    IhtIndex tail ;
+    IhtIndex size ;
+} ;
+
+// GreedyDual min heap, by priority (H) when the entry was queued
+struct iht_heap_entry {
+    uint64_t priority ;
+    IhtIndex item_index ;
+} ;
+
+// TinyLFU frequency sketch (IHT_ADMIT_TINYLFU). Each 64-bit word holds 16 4-bit
+// counters, 4 for each row (row r uses nibbles 4r..4r+3), and each row of a key
+// selects its own word. The doorkeeper bloom filter takes the first access of a
+// key, only keys already in the doorkeeper are counted in the sketch.
+struct iht_sketch {
+    uint64_t *counters ;        // [words_mask+1]
+    uint64_t *doorkeeper ;      // [(door_mask+1)/64], bits
+    uint64_t words_mask ;
+    uint64_t door_mask ;
+    int64_t additions ;         // accesses since the last aging
+    int64_t sample_size ;       // accesses between agings
+} ;
+
+// Adaptive bypass (ihtCacheSetAdaptiveBypass): a timed window of lookups through the
+// cache, followed by a period of lookups through the cache or passed to the filler,
+// by the measured costs.
+typedef enum { BYPASS_MEASURE, BYPASS_CACHE, BYPASS_PASS } BypassPhase ;
+
+struct iht_bypass {
+    BypassPhase phase ;
+    int64_t countdown ;         // lookups left in the phase
+    int64_t pass_period ;       // length of the next pass through period
+    int64_t hits ;              // timed window
+    int64_t hit_cycles ;
+    int64_t misses ;
+    int64_t miss_cycles ;       // with the filler call and the insert
+    int64_t fill_cycles ;
+} ;
+
+// Table replaced by ihtCacheResize. Its entries are moved to the current table, a few
+// slots per lookup (in slot order), or when a lookup finds the key there.
+struct iht_old_table {
+    unsigned char *states ;     // NULL when no migration is pending
+    void *entries ;
+    IhtItem items ;
+    IhtIndex max_entries ;
+    IhtIndex entries_mask ;
+    IhtIndex migrate_index ;    // next slot to migrate
+    IhtIndex count ;            // live entries left
+    unsigned char epoch ;
+    bool wide_index ;
+    EntryFormat entry_format ;
+    bool cleared ;              // all entries removed, values are pending destruction
+} ;
+
+// Misses of a batched get, filled by one call of the batch filler
+struct iht_batch_fill {
+    int count ;
+    int capacity ;
+    int *positions ;            // [capacity] position of the key in the batch
+    IhtHash *hashes ;           // [capacity]
+    char *keys ;                // [capacity] of key_size bytes
+    char *values ;              // [capacity] of value_size bytes
+    uint64_t *ok_mask ;         // [capacity/64]
 } ;
 
 struct iht_cache {
+    struct iht_cache_view view ; // must be first, read by the header inline hit path
     // Configuration
-    int min_capacity ;
+    IhtIndex min_capacity ;
     int key_size ;
     int value_size ;
     double max_load_factor ;
     ihtCacheFiller filler ;
+    ihtCacheBatchFiller batch_filler ;
     void *cxt ;
     ihtCacheCxtDestroyer cxt_destroyer ;
     ihtCacheValueDestroyer value_destroyer ;
+    bool wide_request ;         // use wide entries also for small tables
     // State
     bool fast_mode:1 ;            // Use FastParam and FastResult
     bool fast_key:1 ;
     bool fast_value:1 ;
+    bool wide_key:1 ;             // 32-byte key, compared and hashed as a vector
+    bool wide_mode:1 ;            // Use WideKey and WideValue
     bool short_key:1 ;
+    bool inline_items:1 ;         // Fast mode items stored at the slot index
+    bool wide_index:1 ;           // 64-bit hashes and wide entries
 
-    int item_count ;
-    int max_entries ;           // power of 2
-    int entries_mask ;          // max_entries-1
-    int max_items ;
+    IhtIndex item_count ;
+    IhtIndex max_entries ;      // power of 2
+    IhtIndex entries_mask ;     // max_entries-1
+    IhtIndex max_items ;
     int item_size ;
     int key_offset ;
     int value_offset ;
-    int evict_index ;          // index of next victim for eviction
+    int tag_shift ;             // position of the control byte tag in the hash
+    SizeClass key_class ;       // selects the key compare/hash/copy kernel
+    SizeClass value_class ;     // selects the value copy kernel
+    EntryFormat entry_format ;
+    IhtIndex evict_index ;     // index of next victim for eviction
+    IhtIndex free_item ;       // head of removed items list, -1 if empty
+    IhtIndex item_top ;        // items [item_top, max_items) were never used
+    IhtIndex sweep_index ;     // next slot to check for stale values, max_entries when done
+    unsigned char epoch ;      // current epoch, 0 or STATE_EPOCH_BIT
+    uint64_t evict_seed ;      // random start of eviction windows
+    IhtProbeMode probe_mode ;
+    IhtLayout layout ;
+    IhtEvictionPolicy policy_request ;
+    IhtEvictionPolicy policy ;  // in use, set by setup
+    IhtAdmission admission_request ;
+    IhtAdmission admission ;    // in use, set by setup
+
+    // Eviction policy state, for policies other than IHT_EVICT_CLOCK
+    struct iht_policy_node *nodes ;     // [max_items]
+    struct iht_queue queues[QUEUE_KINDS] ;
+    IhtIndex sieve_hand ;               // next SIEVE candidate, -1 to start at the tail
+    IhtIndex small_target ;             // S3-FIFO small queue size
+    uint32_t *ghost ;                   // S3-FIFO ghost fingerprints, [ghost_mask+1]
+    IhtIndex ghost_mask ;
+    uint64_t lru_clock ;                // sampled LRU use time, GreedyDual inflation L
+    struct iht_heap_entry *heap ;       // GreedyDual, [max_items]
+    IhtIndex heap_size ;
+    bool time_fills ;                   // measure filler calls
+    int64_t fill_cycles_avg ;           // moving average of the filler time
+    int64_t last_fill_cycles ;          // time of the last measured filler call
+
+    bool adaptive_bypass ;
+    struct iht_bypass bypass ;
+
+    struct iht_sketch sketch ;          // IHT_ADMIT_TINYLFU
+    bool bypass_held ;                  // the bypass item holds a rejected value
+    struct iht_batch_fill batch ;       // misses of batched gets, with a batch filler
 
     void *na_value ;            // value representing NA
-    IhtCacheFastKey work_key ;  // Zero-padded key
 
     // Storage
-    unsigned char *states ;     // [max entries]
-    IhtEntry entries ;          // [max_entries]
-    IhtItem items ;             // [max_items] of item_size bytes
+    unsigned char *states ;     // [max entries + GROUP_WIDTH]
+    void *entries ;             // [max_entries] of IhtEntry, or IhtWideEntry
+    IhtItem items ;             // [max_items] of item_size bytes, [max_entries] for inline items
+    struct iht_old_table old ;  // pending migration after resize
     
 
     struct iht_stats stats ;
+    IhtStatsMode stats_mode ;
+    int stats_sample ;                  // sampling rate for IHT_STATS_SAMPLED
+    int sample_tick ;                   // operations until the next sample
+    struct iht_stats_stripe *stripes ;  // [STATS_STRIPES], for IHT_STATS_PER_THREAD
 } ;
 
-static bool use_crc ; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
-
 
 // Accessors
-static inline void *item_addr(IhtCache cache, int item_index) {
+static inline void *item_addr(IhtCache cache, IhtIndex item_index) {
     return ((char*)cache->items) + ((ptrdiff_t) cache->item_size*item_index) ;
 }
 
-static inline void *item_value(IhtCache cache, int item_index) {
+static inline void *item_value(IhtCache cache, IhtIndex item_index) {
     return ((char*) item_addr(cache, item_index)) + cache->value_offset ;
 }
 
-static inline void *item_key(IhtCache cache, int item_index) {
+static inline IhtWideItem wide_items(IhtCache cache) {
+    return (IhtWideItem) cache->items ;
+}
+
+static inline void *item_key(IhtCache cache, IhtIndex item_index) {
     return ((char*) item_addr(cache, item_index)) + cache->key_offset ;
 }
 
-static inline bool is_slot_empty(IhtCache cache, unsigned entry_index) {
-    return empty_slot( (SlotState) cache->states[entry_index] ) ;
+static inline bool is_slot_used(IhtCache cache, IhtIndex entry_index) {
+    return live_slot( cache->states[entry_index], cache->epoch ) ;
+}
+
+// Used for transitions between empty and used, which must be reflected in the
+// mirrored group bytes. Age changes (touch/decay) keep the slot used and the tag
+// intact, and do not need to be mirrored.
+static inline void set_slot_state(IhtCache cache, IhtIndex entry_index, unsigned char state) {
+    cache->states[entry_index] = state ;
+    if ( entry_index < GROUP_WIDTH ) {
+        cache->states[cache->max_entries + entry_index] = state ;
+    }
+}
+
+// Entries are accessed through the table format, so the old table of a resize can
+// use a different encoding than the current one.
+static inline size_t entry_size(EntryFormat format) {
+    switch ( format ) {
+        case ENTRY_NARROW: return sizeof(struct iht_narrow_entry) ;
+        case ENTRY_COMPACT: return sizeof(struct iht_entry) ;
+        default: return sizeof(struct iht_wide_entry) ;
+    }
+}
+
+// Stored form of a hash value. The stored form is enough to find the home slot, and
+// encoding an already stored hash does not change it.
+static inline IhtHash stored_hash(EntryFormat format, IhtIndex entries_mask, IhtHash hash_value) {
+    if ( LIKELY(format == ENTRY_NARROW) ) {
+        return (uint16_t) (hash_value ^ ((hash_value >> UINT16_WIDTH) & ~entries_mask)) ;
+    }
+    return format == ENTRY_COMPACT ? (uint32_t) hash_value : hash_value ;
+}
+
+static inline IhtHash table_hash(const void *entries, EntryFormat format, IhtIndex index) {
+    switch ( format ) {
+        case ENTRY_NARROW: return ((const struct iht_narrow_entry *) entries)[index].hash_value ;
+        case ENTRY_COMPACT: return ((const struct iht_entry *) entries)[index].hash_value ;
+        default: return ((const struct iht_wide_entry *) entries)[index].hash_value ;
+    }
+}
+
+static inline IhtIndex table_item(const void *entries, EntryFormat format, IhtIndex index) {
+    switch ( format ) {
+        case ENTRY_NARROW: return ((const struct iht_narrow_entry *) entries)[index].item_index ;
+        case ENTRY_COMPACT: return ((const struct iht_entry *) entries)[index].item_index ;
+        default: return ((const struct iht_wide_entry *) entries)[index].item_index ;
+    }
+}
+
+static inline void *entry_addr(IhtCache cache, IhtIndex entry_index) {
+    return (char *) cache->entries + entry_index * entry_size(cache->entry_format) ;
+}
+
+// Stored hash, only valid for finding the home slot. Use entry_hash_matches to compare.
+static inline IhtHash entry_hash(IhtCache cache, IhtIndex entry_index) {
+    return table_hash(cache->entries, cache->entry_format, entry_index) ;
+}
+
+static inline IhtHash probe_hash(IhtCache cache, IhtHash hash_value) {
+    return stored_hash(cache->entry_format, cache->entries_mask, hash_value) ;
+}
+
+// stored: the key hash encoded with probe_hash
+static inline bool entry_hash_matches(IhtCache cache, IhtIndex entry_index, IhtHash stored) {
+    return entry_hash(cache, entry_index) == stored ;
 }
 
-static inline bool is_slot_used(IhtCache cache, unsigned entry_index) {
-    return !empty_slot( (SlotState) cache->states[entry_index] ) ;
+static inline IhtIndex entry_item(IhtCache cache, IhtIndex entry_index) {
+    return table_item(cache->entries, cache->entry_format, entry_index) ;
 }
 
-static inline IhtEntry entry_addr(IhtCache cache, unsigned entry_index) {
-    return &cache->entries[entry_index] ;
+static inline void set_entry(IhtCache cache, IhtIndex entry_index, IhtHash hash_value, IhtIndex item_index) {
+    hash_value = probe_hash(cache, hash_value) ;
+    switch ( cache->entry_format ) {
+        case ENTRY_NARROW:
+            ((IhtNarrowEntry) cache->entries)[entry_index] = (struct iht_narrow_entry) { (uint16_t) hash_value, (uint16_t) item_index } ;
+            break ;
+        case ENTRY_COMPACT:
+            ((IhtEntry) cache->entries)[entry_index] = (struct iht_entry) { (uint32_t) hash_value, (int32_t) item_index } ;
+            break ;
+        default:
+            ((IhtWideEntry) cache->entries)[entry_index] = (struct iht_wide_entry) { hash_value, item_index } ;
+    }
+}
+
+// Size specialized kernels: for the common key/value sizes, setup() selects a size
+// class, and compare/copy/hash are compiled with a constant size (inlined, unrolled).
+static inline SizeClass size_class(int size) {
+    switch ( size ) {
+        case 8: return SIZE_8 ;
+        case 16: return SIZE_16 ;
+        case 24: return SIZE_24 ;
+        case 32: return SIZE_32 ;
+        case 48: return SIZE_48 ;
+        case 64: return SIZE_64 ;
+        default: return SIZE_ANY ;
+    }
+}
+
+static inline bool wide_key_equals(const void *key1, const void *key2) {
+#if defined(__AVX2__)
+    __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) key1), _mm256_loadu_si256((const __m256i *) key2)) ;
+    return _mm256_testz_si256(diff, diff) ;
+#else
+    return memcmp(key1, key2, sizeof(IhtCacheWideKey)) == 0 ;
+#endif
+}
+
+static inline bool equal_sized(const void *p1, const void *p2, SizeClass size_class, int size) {
+    switch ( size_class ) {
+        case SIZE_8: return memcmp(p1, p2, 8) == 0 ;
+        case SIZE_16: return memcmp(p1, p2, 16) == 0 ;
+        case SIZE_24: return memcmp(p1, p2, 24) == 0 ;
+        case SIZE_32: return wide_key_equals(p1, p2) ;
+        case SIZE_48: return memcmp(p1, p2, 48) == 0 ;
+        case SIZE_64: return memcmp(p1, p2, 64) == 0 ;
+        default: return memcmp(p1, p2, size) == 0 ;
+    }
+}
+
+static inline void copy_sized(void *dst, const void *src, SizeClass size_class, int size) {
+    switch ( size_class ) {
+        case SIZE_8: memcpy(dst, src, 8) ; break ;
+        case SIZE_16: memcpy(dst, src, 16) ; break ;
+        case SIZE_24: memcpy(dst, src, 24) ; break ;
+        case SIZE_32: memcpy(dst, src, 32) ; break ;
+        case SIZE_48: memcpy(dst, src, 48) ; break ;
+        case SIZE_64: memcpy(dst, src, 64) ; break ;
+        default: memcpy(dst, src, size) ;
+    }
 }
 
 static inline bool key_equals(IhtCache cache, const void *key1, const void *key2) {
-    return memcmp(key1, key2, cache->key_size) == 0 ;
+    return equal_sized(key1, key2, cache->key_class, cache->key_size) ;
+}
+
+static inline void copy_key(IhtCache cache, void *dst, const void *src) {
+    copy_sized(dst, src, cache->key_class, cache->key_size) ;
+}
+
+static inline void copy_value(IhtCache cache, void *dst, const void *src) {
+    copy_sized(dst, src, cache->value_class, cache->value_size) ;
 }
 
 static inline bool fast_key_equals(IhtCacheFastKey key1, IhtCacheFastKey key2) {
     return ((key1.v0 ^ key2.v0 ) | (key1.v1 ^ key2.v1)) == 0 ;
 }
 
-static inline int next_entry(IhtCache cache, int index) {
+static inline IhtIndex next_entry(IhtCache cache, IhtIndex index) {
     return (index + 1) & cache->entries_mask ;
 }
 
-static inline int hash_entry(IhtCache cache, unsigned int hash_value)
+static inline IhtIndex hash_entry(IhtCache cache, IhtHash hash_value)
 {
-    return (int) (hash_value & cache->entries_mask);
+    return (IhtIndex) (hash_value & cache->entries_mask);
 
 }
 
+// The CRC hash is selected at compile time. With runtime dispatch, the SSE4.2 and
+// higher builds use it, and all caches of a process use the same build.
+#if defined(__SSE4_2__)
 // NOLINT((llvm-include-order)
 #include <nmmintrin.h>
 
-__attribute__((target("sse4.2")))
 static inline uint32_t fast_key_hash(IhtCacheFastKey key)
 {
-    if ( LIKELY(use_crc) ) {
-        uint32_t crc = KNUTH_GOLD_32 ;
-#ifdef __x86_64__
-        crc = (uint32_t) _mm_crc32_u64(crc, key.v0) ;
-        crc = (uint32_t) _mm_crc32_u64(crc, key.v1) ;
+    uint32_t crc = KNUTH_GOLD_32 ;
+    crc = (uint32_t) _mm_crc32_u64(crc, key.v0) ;
+    crc = (uint32_t) _mm_crc32_u64(crc, key.v1) ;
+    return crc ;
+}
 #else
-        crc = _mm_crc32_u32(crc, (int32_t) (key.v0>>32));
-        crc = _mm_crc32_u32(crc, (int32_t) (key.));
-        crc = _mm_crc32_u32(crc, (int32_t) (lo>>32));
-        crc = _mm_crc32_u32(crc, (int32_t) (lo));
-#endif
-        return crc ;
-
-    // Without support for SSE4.2 - no CRC instructions.
-    } 
+// Without support for SSE4.2 - no CRC instructions.
+static inline uint32_t fast_key_hash(IhtCacheFastKey key)
+{
     uint64_t h = key.v0 ^ (key.v1 + KNUTH_GOLD_64);
     h *= KNUTH_GOLD_64;
     // Reduce to 32 bit, mix high/low 16 bits.
@@ -167,31 +555,100 @@ static inline uint32_t fast_key_hash(IhtCacheFastKey key)
     h ^= h >> UINT16_WIDTH ;
     return (uint32_t)h;
 }
+#endif
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33 ;
+    h *= FMIX_C1 ;
+    h ^= h >> 33 ;
+    h *= FMIX_C2 ;
+    h ^= h >> 33 ;
+    return h ;
+}
 
-static inline uint32_t key_hash(IhtCache cache, const void *key)
+// Wide tables select slots with more than 32 bits, and need a full 64-bit hash.
+static inline IhtHash fast_key_hash_width(IhtCacheFastKey key, bool wide)
 {
-    if ( cache->short_key ) {
-        memcpy( &cache->work_key, key, cache->key_size) ;
-        return fast_key_hash ( cache->work_key) ;
-    } ;
-    if ( cache->fast_key ) {
-        return fast_key_hash( *(IhtCacheFastKey *) key) ;
-    }
+    if ( UNLIKELY(wide) ) return mix64(key.v0 ^ mix64(key.v1 + KNUTH_GOLD_64)) ;
+    return fast_key_hash(key) ;
+}
 
-    int bytes = cache->key_size ;
+static inline IhtHash fast_hash(IhtCache cache, IhtCacheFastKey key)
+{
+    return fast_key_hash_width(key, cache->wide_index) ;
+}
+
+// 32-byte keys are hashed in two independent multiply lanes (v0,v1 and v2,v3), so
+// their latencies overlap. CRC lanes are not used: CRC is linear, and keys made of
+// related doubles (e.g. v, v+1, v+2, v+3) cluster badly.
+static inline IhtHash wide_key_hash_width(const void *key, bool wide)
+{
+    IhtCacheWideKey k ;
+    memcpy(&k, key, sizeof(k)) ;
+    uint64_t lo = ((k.v0 + KNUTH_GOLD_64) * KNUTH_GOLD_64 ^ k.v1) * KNUTH_GOLD_64 ;
+    uint64_t hi = ((k.v2 + FMIX_C1) * KNUTH_GOLD_64 ^ k.v3) * KNUTH_GOLD_64 ;
+    uint64_t h = lo ^ ((hi << 32) | (hi >> 32)) ;
+    if ( UNLIKELY(wide) ) return mix64(h) ;
+    h ^= h >> UINT32_WIDTH ;
+    h ^= h >> UINT16_WIDTH ;
+    return (uint32_t)h;
+}
+
+static inline IhtHash wide_hash(IhtCache cache, const IhtCacheWideKey *key)
+{
+    return wide_key_hash_width(key, cache->wide_index) ;
+}
+
+__attribute__((always_inline))
+static inline uint64_t hash_bytes(const void *key, int bytes)
+{
     uint64_t h = KNUTH_GOLD_64 + bytes ;
     int pos = 0 ;
-    for (pos = 0 ; pos<bytes ; pos+= sizeof(h) ) {
-        h ^= *(uint64_t *) ((char *) key + pos ) ;
+    for (pos = 0 ; pos + int_sizeof(h) <= bytes ; pos+= sizeof(h) ) {
+        uint64_t word ;
+        memcpy( &word, (const char *) key + pos, sizeof(word) ) ;
+        h ^= word ;
         h *= KNUTH_GOLD_64;
     }
     int n_tail = bytes - pos ;
     if ( n_tail > 0 ) {
         uint64_t tail = 0 ;
-        memcpy( &tail, (char *) key + pos, n_tail ) ;
+        memcpy( &tail, (const char *) key + pos, n_tail ) ;
         h ^= tail ;
         h *= KNUTH_GOLD_64;        
     }
+    return h ;
+}
+
+static inline uint64_t hash_sized(const void *key, SizeClass size_class, int size)
+{
+    switch ( size_class ) {
+        case SIZE_24: return hash_bytes(key, 24) ;
+        case SIZE_32: return hash_bytes(key, 32) ;
+        case SIZE_48: return hash_bytes(key, 48) ;
+        case SIZE_64: return hash_bytes(key, 64) ;
+        default: return hash_bytes(key, size) ;
+    }
+}
+
+static inline IhtHash key_hash_width(IhtCache cache, const void *key, bool wide)
+{
+    if ( cache->short_key ) {
+        // Zero-padded copy on the stack: hashing does not write to the cache
+        IhtCacheFastKey work_key = { 0 } ;
+        memcpy( &work_key, key, cache->key_size) ;
+        return fast_key_hash_width( work_key, wide) ;
+    } ;
+    if ( cache->fast_key ) {
+        return fast_key_hash_width( *(IhtCacheFastKey *) key, wide) ;
+    }
+    if ( cache->wide_key ) {
+        return wide_key_hash_width(key, wide) ;
+    }
+
+    uint64_t h = hash_sized(key, cache->key_class, cache->key_size) ;
+    if ( UNLIKELY(wide) ) return mix64(h) ;
 
     // Reduce to 32 bit, mix high/low 16 bits.
     h ^= h >> UINT32_WIDTH ;   
@@ -199,46 +656,208 @@ static inline uint32_t key_hash(IhtCache cache, const void *key)
     return (uint32_t)h;
 }
 
-static inline void bump_counter(IhtCounter *c, int scans)
+static inline IhtHash key_hash(IhtCache cache, const void *key)
+{
+    return key_hash_width(cache, key, cache->wide_index) ;
+}
+
+// Probe length histogram bucket: 0 for no scans, b for [2^(b-1), 2^b), the last
+// bucket is open ended.
+static inline int probe_bucket(IhtIndex scans)
+{
+    if ( scans <= 0 ) return 0 ;
+    int bucket = UINT64_WIDTH - __builtin_clzll((uint64_t) scans) ;
+    return bucket < IHT_PROBE_BUCKETS ? bucket : IHT_PROBE_BUCKETS - 1 ;
+}
+
+#if !defined(IHT_NO_STATS)
+static _Thread_local int thread_stripe = -1 ;   // stripe of the thread, -1 if not assigned
+static int next_stripe ;
+
+static inline int stats_stripe(void)
+{
+    if ( UNLIKELY(thread_stripe < 0) ) {
+        thread_stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % STATS_STRIPES ;
+    }
+    return thread_stripe ;
+}
+
+static inline struct iht_stats *thread_stats(IhtCache cache)
+{
+    return &cache->stripes[stats_stripe()].stats ;
+}
+
+// Stripes may be shared by threads: relaxed atomic accesses, without a locked add.
+// These compile to plain loads and stores.
+static inline void add_relaxed(int64_t *counter, int64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED) ;
+}
+
+// Counters to update for an operation, and its weight. NULL if the operation is not
+// counted (statistics off, or not sampled).
+static inline struct iht_stats *stats_target(IhtCache cache, int64_t *weight)
+{
+    *weight = 1 ;
+    switch ( cache->stats_mode ) {
+        case IHT_STATS_FULL:
+            return &cache->stats ;
+        case IHT_STATS_SAMPLED:
+            // One operation in stats_sample is counted, with weight stats_sample
+            if ( LIKELY(--cache->sample_tick > 0) ) return NULL ;
+            cache->sample_tick = cache->stats_sample ;
+            *weight = cache->stats_sample ;
+            return &cache->stats ;
+        case IHT_STATS_PER_THREAD:
+            return thread_stats(cache) ;
+        default:
+            return NULL ;
+    }
+}
+#endif
+
+// Record an operation with its probe length, and for evictions the age of the victim
+// (-1 otherwise), according to the statistics mode
+static inline void count_op(IhtCache cache, StatKind kind, IhtIndex scans, int victim_age)
+{
+#if defined(IHT_NO_STATS)
+    (void) cache ; (void) kind ; (void) scans ; (void) victim_age ;
+#else
+    int64_t weight ;
+    struct iht_stats *stats = stats_target(cache, &weight) ;
+    if ( !stats ) return ;
+    IhtCounter *c = &stats->counters[kind] ;
+    add_relaxed(&c->count, weight) ;
+    add_relaxed(&c->scans, scans * weight) ;
+    add_relaxed(&c->probe_hist[probe_bucket(scans)], weight) ;
+    if ( victim_age >= 0 ) add_relaxed(&stats->victim_ages[victim_age], weight) ;
+#endif
+}
+
+static inline void count_stat(IhtCache cache, StatKind kind, IhtIndex scans)
 {
-    c->count++ ;
-    c->scans += scans ;  
+    count_op(cache, kind, scans, -1) ;
+}
+
+static inline void count_fill(IhtCache cache, int64_t cycles)
+{
+#if defined(IHT_NO_STATS)
+    (void) cache ; (void) cycles ;
+#else
+    int64_t weight ;
+    struct iht_stats *stats = stats_target(cache, &weight) ;
+    if ( stats ) add_relaxed(&stats->fill_cycles, cycles * weight) ;
+#endif
 }
 
-static inline void touch_entry(IhtCache cache, int index) {
-    SlotState state = cache->states[index] ;
-    if ( state < SLOT_MAX_AGE ) {
+static inline void touch_entry(IhtCache cache, IhtIndex index) {
+    unsigned char state = cache->states[index] ;
+    if ( slot_age(state) < SLOT_MAX_AGE ) {
         cache->states[index] = state+1 ;
     }
 }
 
+// Group matching: returns a bit per slot in the group whose tag and epoch match, and
+// a bit per slot that terminates the probe (empty, removed or stale).
+#define STATE_MATCH_MASK (STATE_TAG_MASK | STATE_EPOCH_BIT)
+#if defined(__AVX512BW__)
+static inline GroupMask group_match(const unsigned char *ctrl, unsigned char tag, unsigned char epoch, GroupMask *stop)
+{
+    __m512i group = _mm512_loadu_si512(ctrl) ;
+    __m512i epochs = _mm512_and_si512(group, _mm512_set1_epi8(STATE_EPOCH_BIT)) ;
+    __mmask64 empty = _mm512_testn_epi8_mask(group, _mm512_set1_epi8(STATE_LIVE_MASK)) ;
+    __mmask64 stale = _mm512_cmpeq_epi8_mask(epochs, _mm512_set1_epi8((char) (epoch ^ STATE_EPOCH_BIT))) ;
+    *stop = empty | stale ;
+    __m512i tags = _mm512_and_si512(group, _mm512_set1_epi8((char) STATE_MATCH_MASK)) ;
+    return _mm512_cmpeq_epi8_mask(tags, _mm512_set1_epi8((char) (tag | epoch))) ;
+}
+#elif defined(__AVX2__)
+static inline GroupMask group_match(const unsigned char *ctrl, unsigned char tag, unsigned char epoch, GroupMask *stop)
+{
+    __m256i group = _mm256_loadu_si256((const __m256i *) ctrl) ;
+    __m256i tags = _mm256_and_si256(group, _mm256_set1_epi8((char) STATE_MATCH_MASK)) ;
+    __m256i live = _mm256_and_si256(group, _mm256_set1_epi8(STATE_LIVE_MASK)) ;
+    __m256i epochs = _mm256_and_si256(group, _mm256_set1_epi8(STATE_EPOCH_BIT)) ;
+    __m256i stale = _mm256_cmpeq_epi8(epochs, _mm256_set1_epi8((char) (epoch ^ STATE_EPOCH_BIT))) ;
+    *stop = (GroupMask) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(live, _mm256_setzero_si256()), stale)) ;
+    return (GroupMask) _mm256_movemask_epi8(_mm256_cmpeq_epi8(tags, _mm256_set1_epi8((char) (tag | epoch)))) ;
+}
+#else
+static inline GroupMask group_match(const unsigned char *ctrl, unsigned char tag, unsigned char epoch, GroupMask *stop)
+{
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl) ;
+    __m128i tags = _mm_and_si128(group, _mm_set1_epi8((char) STATE_MATCH_MASK)) ;
+    __m128i live = _mm_and_si128(group, _mm_set1_epi8(STATE_LIVE_MASK)) ;
+    __m128i epochs = _mm_and_si128(group, _mm_set1_epi8(STATE_EPOCH_BIT)) ;
+    __m128i stale = _mm_cmpeq_epi8(epochs, _mm_set1_epi8((char) (epoch ^ STATE_EPOCH_BIT))) ;
+    *stop = (GroupMask) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(live, _mm_setzero_si128()), stale)) ;
+    return (GroupMask) _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8((char) (tag | epoch)))) ;
+}
+#endif
+
+static void update_fill_timing(IhtCache cache) {
+    cache->time_fills = cache->policy == IHT_EVICT_GREEDY_DUAL ||
+        (cache->adaptive_bypass && cache->bypass.phase == BYPASS_MEASURE) ;
+}
+
 static void setup(IhtCache cache) {
     // Initialization logic for the cache
-    int capacity = cache->min_capacity;
+    IhtIndex capacity = cache->min_capacity;
     if ( capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
 
-    int min_entries = (int) ceil(capacity/cache->max_load_factor) ;
+    IhtIndex min_entries = (IhtIndex) ceil(capacity/cache->max_load_factor) ;
 
     // round up to next power of two for item_count
-    int max_entries = 1;
+    IhtIndex max_entries = 1;
     while (max_entries < min_entries) max_entries *= 2;
+    if ( cache->probe_mode == IHT_PROBE_GROUP && max_entries < GROUP_WIDTH ) max_entries = GROUP_WIDTH ;
+
+    // Compact entries hold 32-bit hashes and item indexes
+    cache->wide_index = cache->wide_request || max_entries > INT32_MAX ;
+    cache->tag_shift = cache->wide_index ? WIDE_TAG_SHIFT : COMPACT_TAG_SHIFT ;
+    cache->entry_format = cache->wide_index ? ENTRY_WIDE :
+        max_entries <= NARROW_MAX_ENTRIES ? ENTRY_NARROW : ENTRY_COMPACT ;
 
     cache->item_count = 0;
+    cache->free_item = -1 ;
+    cache->item_top = 0 ;
+    cache->sweep_index = max_entries ;
+    cache->epoch = 0 ;
     cache->max_entries = max_entries;
     cache->entries_mask = max_entries - 1;
-    cache->max_items = (int) (max_entries * cache->max_load_factor);
+    cache->max_items = (IhtIndex) (max_entries * cache->max_load_factor);
+    cache->evict_index = 0 ;
+    cache->evict_seed = KNUTH_GOLD_64 ;
+    cache->policy = cache->policy_request ;
+    cache->admission = cache->admission_request ;
+    update_fill_timing(cache) ;
+    cache->small_target = (IhtIndex) (cache->max_items * S3FIFO_SMALL_RATIO) ;
+    if ( cache->small_target < 1 ) cache->small_target = 1 ;
+    cache->ghost_mask = 0 ;
+    while ( cache->ghost_mask < cache->max_items ) cache->ghost_mask = 2*cache->ghost_mask + 1 ;
 
     cache->short_key = (cache->key_size < int_sizeof(IhtCacheFastKey)) ;
     cache->fast_key = (cache->key_size <= int_sizeof(IhtCacheFastKey));
     cache->fast_value = (cache->value_size <= int_sizeof(IhtCacheFastValue));
+    cache->key_class = size_class(cache->key_size) ;
+    cache->value_class = size_class(cache->value_size) ;
 
     bool fast_mode = cache->fast_mode = cache->fast_key && cache->fast_value ;
+    // The queue and LRU policies keep metadata by item index, which is only stable
+    // with indirect items
+    cache->inline_items = fast_mode && cache->layout == IHT_LAYOUT_INLINE && cache->policy == IHT_EVICT_CLOCK ;
+    cache->wide_key = (cache->key_size == int_sizeof(IhtCacheWideKey)) ;
+    cache->wide_mode = cache->wide_key && cache->value_size <= int_sizeof(IhtCacheWideValue) ;
     
     cache->key_offset = offsetof(struct iht_item, key);
     cache->value_offset = offsetof(struct iht_item, value);
     cache->item_size = sizeof(struct iht_item);
 
-    if ( !fast_mode ) {
+    if ( cache->wide_mode ) {
+        cache->key_offset = offsetof(struct iht_wide_item, key);
+        cache->value_offset = offsetof(struct iht_wide_item, value);
+        cache->item_size = sizeof(struct iht_wide_item);
+    } else if ( !fast_mode ) {
         cache->item_size = cache->key_size + cache->value_size ;
         int max_align = alignof(max_align_t) ;
         if ( cache->key_offset < cache->value_offset && !cache->fast_key) {
@@ -254,13 +873,102 @@ static void setup(IhtCache cache) {
 
 }
 
+// Number of items allocated - inline items have one item per slot
+static inline IhtIndex item_slots(IhtCache cache) {
+    return cache->inline_items ? cache->max_entries : cache->max_items ;
+}
+
+// Publish the state used by ihtCacheGet_FastInline(). Called whenever the tables, the
+// epoch, or the pending migration change.
+static void update_view(IhtCache cache) {
+    _Static_assert(sizeof(struct iht_view_item) == sizeof(struct iht_item), "view item layout") ;
+    struct iht_cache_view *view = &cache->view ;
+    // Admission counts every access, hits included. The adaptive bypass times lookups.
+    bool enabled = cache->inline_items && cache->states && !cache->old.states &&
+        cache->admission == IHT_ADMIT_ALL && !cache->adaptive_bypass ;
+    view->states = enabled ? cache->states : NULL ;
+    view->items = (struct iht_view_item *) cache->items ;
+    view->slot_mask = (uint64_t) cache->entries_mask ;
+    view->tag_shift = cache->tag_shift ;
+    view->epoch = cache->epoch ;
+    view->count_hits = ihtCacheGetStatsMode(cache) == IHT_STATS_FULL ;
+#if defined(__SSE4_2__)
+    view->hash_kind = cache->wide_index ? IHT_VIEW_HASH_WIDE : IHT_VIEW_HASH_CRC ;
+#else
+    view->hash_kind = cache->wide_index ? IHT_VIEW_HASH_WIDE : IHT_VIEW_HASH_MUL ;
+#endif
+}
+
+static void reset_policy(IhtCache cache) {
+    for (int q = 0 ; q < QUEUE_KINDS ; q++) {
+        cache->queues[q] = (struct iht_queue) { .head = -1, .tail = -1 } ;
+    }
+    cache->sieve_hand = -1 ;
+    cache->lru_clock = 0 ;
+    cache->heap_size = 0 ;
+}
+
+static void allocate_policy(IhtCache cache) {
+    reset_policy(cache) ;
+    if ( cache->policy == IHT_EVICT_CLOCK ) return ;
+    cache->nodes = calloc(cache->max_items, sizeof(*cache->nodes)) ;
+    if ( cache->policy == IHT_EVICT_S3FIFO ) {
+        cache->ghost = calloc(cache->ghost_mask + 1, sizeof(*cache->ghost)) ;
+    }
+    if ( cache->policy == IHT_EVICT_GREEDY_DUAL ) {
+        cache->heap = calloc(cache->max_items, sizeof(*cache->heap)) ;
+    }
+}
+
+static void free_policy(IhtCache cache) {
+    free(cache->nodes) ;
+    cache->nodes = NULL ;
+    free(cache->ghost) ;
+    cache->ghost = NULL ;
+    free(cache->heap) ;
+    cache->heap = NULL ;
+}
+
+static void allocate_sketch(IhtCache cache) {
+    struct iht_sketch *sketch = &cache->sketch ;
+    *sketch = (struct iht_sketch) {} ;
+    if ( cache->admission != IHT_ADMIT_TINYLFU ) return ;
+    uint64_t words = 1 ;
+    while ( words < (uint64_t) cache->max_items / 4 ) words *= 2 ;
+    uint64_t door_bits = UINT64_WIDTH ;
+    while ( door_bits < (uint64_t) cache->max_items * DOORKEEPER_BITS_PER_ITEM ) door_bits *= 2 ;
+    sketch->counters = calloc(words, sizeof(*sketch->counters)) ;
+    sketch->doorkeeper = calloc(door_bits / UINT64_WIDTH, sizeof(*sketch->doorkeeper)) ;
+    sketch->words_mask = words - 1 ;
+    sketch->door_mask = door_bits - 1 ;
+    sketch->sample_size = SKETCH_SAMPLE_RATIO * cache->max_items ;
+}
+
+static void free_sketch(IhtCache cache) {
+    free(cache->sketch.counters) ;
+    free(cache->sketch.doorkeeper) ;
+    cache->sketch = (struct iht_sketch) {} ;
+}
+
 static void allocate(IhtCache cache) {
     // Memory allocation logic for entries and items
-    cache->entries = calloc(cache->max_entries, sizeof(*cache->entries));
-    cache->items = calloc(cache->max_items, cache->item_size);
-    cache->states = calloc(cache->max_entries, sizeof(*cache->states));
-    int na_size = cache->fast_value ? int_sizeof(IhtCacheFastValue) : cache->value_size ;
+    cache->entries = calloc(cache->max_entries, entry_size(cache->entry_format));
+    if ( cache->wide_mode ) {
+        // Keep each wide item in a single cache line
+        size_t items_size = (item_slots(cache) + 1) * (size_t) cache->item_size ;
+        cache->items = aligned_alloc(WIDE_ITEM_ALIGN, items_size) ;
+        bzero(cache->items, items_size) ;
+    } else {
+        // One more item, for values rejected by the admission filter
+        cache->items = calloc(item_slots(cache) + 1, cache->item_size);
+    }
+    cache->states = calloc(cache->max_entries + GROUP_WIDTH, sizeof(*cache->states));
+    int na_size = cache->fast_value ? int_sizeof(IhtCacheFastValue) :
+        cache->wide_mode ? int_sizeof(IhtCacheWideValue) : cache->value_size ;
     if ( !cache->na_value) cache->na_value = calloc(1, na_size) ;
+    allocate_policy(cache) ;
+    allocate_sketch(cache) ;
+    update_view(cache) ;
 }
 
 static void deallocate(IhtCache cache) {
@@ -270,367 +978,2409 @@ static void deallocate(IhtCache cache) {
     cache->items = NULL;
     free(cache->states);
     cache->states = NULL;
+    free_policy(cache) ;
+    free_sketch(cache) ;
+    update_view(cache) ;
 }
 
-static void remove_all(IhtCache cache) {
-    // Logic to remove all entries from the cache
+static void drop_old_table(IhtCache cache) {
+    struct iht_old_table *old = &cache->old ;
+    if ( !old->states ) return ;
     if ( cache->value_destroyer ) {
-        for (int i = 0; i < cache->max_entries; i++) {
-            if ( !is_slot_empty(cache, i) ) {
-                IhtEntry e = entry_addr(cache, i);
-                cache->value_destroyer(cache->cxt, item_value(cache, e->item_index));
+        for (IhtIndex i = old->migrate_index ; i < old->max_entries ; i++) {
+            if ( value_slot(old->states[i]) ) {
+                IhtIndex item_index = table_item(old->entries, old->entry_format, i) ;
+                char *item = ((char *) old->items) + ((ptrdiff_t) cache->item_size*item_index) ;
+                cache->value_destroyer(cache->cxt, item + cache->value_offset);
             }
         }
     }
-    cache->item_count = 0;
-    bzero(cache->entries, cache->max_entries * sizeof(*cache->entries));
-    bzero(cache->states, cache->max_entries * sizeof(*cache->states));
-    bzero(cache->items, cache->max_items * (size_t) cache->item_size);
+    free(old->states) ;
+    free(old->entries) ;
+    free(old->items) ;
+    *old = (struct iht_old_table) {} ;
+    update_view(cache) ;
 }
 
-static IhtEntry lookup_entry(IhtCache cache, const void *key) {
-    // Logic to look up an entry by key
-    unsigned hash = key_hash(cache, key);
-    int index = hash_entry(cache, hash) ;
-    IhtEntry e = entry_addr(cache, index) ;
-    cache->stats.lookups++ ;
-    int scans = 0 ;
-    while ( is_slot_used(cache, index) ) {
-        if ( e->hash_value == hash ) {
-            if ( key_equals(cache, item_key(cache, e->item_index), key) ) {
-                bump_counter(&cache->stats.hits, scans) ;
-                touch_entry(cache, index) ;
-                return e ;
+// Release the last value rejected by the admission filter, held in the item after
+// the cache items.
+static void release_bypass(IhtCache cache) {
+    if ( !cache->bypass_held ) return ;
+    if ( cache->value_destroyer ) cache->value_destroyer(cache->cxt, item_value(cache, item_slots(cache))) ;
+    cache->bypass_held = false ;
+}
+
+static void remove_all(IhtCache cache) {
+    // Logic to remove all entries from the cache, including stale ones
+    drop_old_table(cache) ;
+    release_bypass(cache) ;
+    if ( cache->value_destroyer ) {
+        for (IhtIndex i = 0; i < cache->max_entries; i++) {
+            if ( value_slot(cache->states[i]) ) {
+                cache->value_destroyer(cache->cxt, item_value(cache, entry_item(cache, i)));
             }
         }
-        index = next_entry(cache, index) ;
-        e = entry_addr(cache, index) ;
-        scans++ ;
     }
-    bump_counter(&cache->stats.misses, scans);
-    return NULL; // Not found
+    cache->item_count = 0;
+    cache->free_item = -1 ;
+    cache->item_top = 0 ;
+    cache->sweep_index = cache->max_entries ;
+    cache->epoch = 0 ;
+    reset_policy(cache) ;
+    if ( cache->ghost ) bzero(cache->ghost, (cache->ghost_mask + 1) * sizeof(*cache->ghost)) ;
+    update_view(cache) ;
+    bzero(cache->entries, cache->max_entries * entry_size(cache->entry_format));
+    bzero(cache->states, (cache->max_entries + GROUP_WIDTH) * sizeof(*cache->states));
+    bzero(cache->items, item_slots(cache) * (size_t) cache->item_size);
 }
 
-static IhtEntry fast_lookup_entry(IhtCache cache, IhtCacheFastKey key) {
-    // Logic to look up an entry by key
-    unsigned hash = fast_key_hash(key);
-    int index = hash_entry(cache, hash) ;
-    cache->stats.lookups++ ;
+// Probe results. A failed lookup leaves the hash and the first free slot of the probe
+// sequence, so a following insert of the same key does not hash and probe again.
+struct iht_probe {
+    IhtHash hash ;
+    IhtIndex slot ;          // first free slot (for a miss)
+    int scans ;         // probe length
+    unsigned char cost_class ;  // measured filler cost of the new entry, 0 if unknown
+} ;
+
+static inline IhtIndex slot_item(IhtCache cache, IhtIndex index) {
+    return cache->inline_items ? index : entry_item(cache, index) ;
+}
 
-    // Unroll the first check, mostly likely to be a hit
-    SlotState state = cache->states[index] ;
-    if ( UNLIKELY(empty_slot(state)) ) {
-        bump_counter(&cache->stats.misses, 0);
-        return NULL ;
+// stored: the key hash, encoded with probe_hash
+static inline bool slot_matches(IhtCache cache, IhtIndex index, const void *key, IhtHash stored, KeyKind kind)
+{
+    if ( kind == KEY_FAST && cache->inline_items ) {
+        // Item is stored in the slot, no need to go through entries[]
+        return fast_key_equals(cache->items[index].key, *(const IhtCacheFastKey *) key) ;
+    }
+    if ( !entry_hash_matches(cache, index, stored) ) return false ;
+    IhtIndex item_index = entry_item(cache, index) ;
+    switch ( kind ) {
+        case KEY_FAST: return fast_key_equals(cache->items[item_index].key, *(const IhtCacheFastKey *) key) ;
+        case KEY_WIDE: return wide_key_equals(&wide_items(cache)[item_index].key, key) ;
+        default: return key_equals(cache, item_key(cache, item_index), key) ;
     }
+}
 
-    IhtEntry e = &cache->entries[index] ;
-    if ( LIKELY(e->hash_value == hash) ) {
-        if ( LIKELY(fast_key_equals( cache->items[e->item_index].key, key)) ) {
-            bump_counter(&cache->stats.hits, 0) ;
-            if ( state < SLOT_MAX_AGE ) cache->states[index] = state+1 ;
-            return e ;
+// Group probing: scan GROUP_WIDTH control bytes at a time, and only look at entries[]
+// and items[] for slots whose tag matches. The probe sequence is the same as the linear
+// probe, so inserts and evictions work unchanged.
+static inline IhtIndex group_probe(IhtCache cache, const void *key, struct iht_probe *probe, KeyKind kind)
+{
+    IhtHash hash = probe->hash ;
+    IhtHash stored = probe_hash(cache, hash) ;
+    unsigned char tag = hash_tag(hash, cache->tag_shift) ;
+    IhtIndex home = hash_entry(cache, hash) ;
+    IhtIndex base = home ;
+
+    for (;;) {
+        GroupMask stop ;
+        GroupMask match = group_match(cache->states + base, tag, cache->epoch, &stop) ;
+        if ( stop ) match &= (stop & -stop) - 1 ;
+        while ( match ) {
+            IhtIndex index = (base + __builtin_ctzll(match)) & cache->entries_mask ;
+            if ( LIKELY(slot_matches(cache, index, key, stored, kind)) ) {
+                probe->scans = (index - home) & cache->entries_mask ;
+                return index ;
+            }
+            match &= match - 1 ;
+        }
+        if ( stop ) {
+            probe->slot = (base + __builtin_ctzll(stop)) & cache->entries_mask ;
+            probe->scans = (probe->slot - home) & cache->entries_mask ;
+            return -1 ;
         }
+        base = (base + GROUP_WIDTH) & cache->entries_mask ;
     }
+}
 
-    index = next_entry(cache, index) ;
-    int scans = 1 ;
-
+static inline IhtIndex linear_probe(IhtCache cache, const void *key, struct iht_probe *probe, KeyKind kind)
+{
+    IhtHash hash = probe->hash ;
+    IhtHash stored = probe_hash(cache, hash) ;
+    IhtIndex index = hash_entry(cache, hash) ;
+    int scans = 0 ;
     while ( is_slot_used(cache, index) ) {
-        e = &cache->entries[index] ;
-        if ( LIKELY(e->hash_value == hash) ) {
-            if ( LIKELY(fast_key_equals( cache->items[e->item_index].key, key)) ) {
-                bump_counter(&cache->stats.hits, scans) ;
-                touch_entry(cache, index);
-                return e ;
-            }   
-        }   
+        if ( LIKELY(slot_matches(cache, index, key, stored, kind)) ) {
+            probe->scans = scans ;
+            return index ;
+        }
         index = next_entry(cache, index) ;
         scans++ ;
     }
-    bump_counter(&cache->stats.misses, scans);
-    return NULL; // Not found
+    probe->slot = index ;
+    probe->scans = scans ;
+    return -1 ;
 }
 
-static int find_victim(IhtCache cache) {
-    SlotState victim_state = SLOT_MAX_AGE + 1 ;
-    int scans = 0 ;
-    int index = cache->evict_index ;
-    int victim_index = index ;
+// Probe distance of the entry at index from its home slot
+static inline IhtIndex slot_distance(IhtCache cache, IhtIndex index) {
+    return (index - hash_entry(cache, entry_hash(cache, index))) & cache->entries_mask ;
+}
 
-    for (int search = MAX_EVICTION_SEARCH ; search > 0 ; scans++, index = next_entry(cache, index) ) {
-        SlotState slot_state = cache->states[index];
-        if ( empty_slot(slot_state) ) continue ;
-        if ( slot_state < victim_state ) {
-            victim_index = index ;
-            victim_state = slot_state ;
-            if ( victim_state == SLOT_MIN_AGE ) {
-                search = 0 ;
-                continue ;
-            }
-        } ;
-        cache->states[index] = slot_state - 1 ;
-        // Limit scan to slow evictions
-        search-- ;
+// Robin Hood probing: entries along a chain are ordered by probe distance, so the
+// lookup can stop at the first entry that is closer to its home slot than the key
+// would be. The miss slot is where the key will be placed, displacing that entry.
+static inline IhtIndex robin_hood_probe(IhtCache cache, const void *key, struct iht_probe *probe, KeyKind kind)
+{
+    IhtHash hash = probe->hash ;
+    IhtHash stored = probe_hash(cache, hash) ;
+    IhtIndex index = hash_entry(cache, hash) ;
+    IhtIndex dist = 0 ;
+    while ( is_slot_used(cache, index) ) {
+        if ( LIKELY(slot_matches(cache, index, key, stored, kind)) ) {
+            probe->scans = dist ;
+            return index ;
+        }
+        if ( slot_distance(cache, index) < dist ) break ;
+        index = next_entry(cache, index) ;
+        dist++ ;
     }
-    cache->evict_index = index ;
-    bump_counter(&cache->stats.evictions, scans);
-
-    return victim_index ;
+    probe->slot = index ;
+    probe->scans = dist ;
+    return -1 ;
 }
 
-static IhtEntry alloc_new_entry(IhtCache cache, const void *key)
+// Returns the slot index holding key, or -1 if not found.
+static inline IhtIndex probe_slot(IhtCache cache, const void *key, struct iht_probe *probe, KeyKind kind)
 {
-//    IhtEntry victim = NULL ;
-    int victim_index = -1 ;
-    SlotState victim_state = SLOT_EMPTY ;
-    //struct iht_entry victim_entry ;
-    int new_entry_index = cache->item_count ;
-
-    if ( LIKELY(new_entry_index >= cache->max_items )) {
-//        victim = find_victim(cache) ;
-        // victim is saved for the unlikley case that the key is already in the cache
-        // in this case, the victim will be resurretced .
-        victim_index = find_victim(cache) ;
-        victim_state = cache->states[victim_index] ;
-        cache->states[victim_index] = SLOT_EMPTY ;
-        //        victim_entry = *victim ;
-//        *victim = (struct iht_entry) {} ;
-        cache->item_count--;
-        new_entry_index = cache->entries[victim_index].item_index ;
+    if ( cache->probe_mode == IHT_PROBE_GROUP ) {
+        return group_probe(cache, key, probe, kind) ;
     }
+    if ( cache->probe_mode == IHT_PROBE_ROBIN_HOOD ) {
+        return robin_hood_probe(cache, key, probe, kind) ;
+    }
+    return linear_probe(cache, key, probe, kind) ;
+}
 
-    unsigned hash_value = key_hash(cache, key); 
-    int index = hash_entry(cache, hash_value) ;
-    IhtEntry e = entry_addr(cache, index) ;
-    int scans = 0 ;
-    while ( is_slot_used(cache, index) ) {
-        // Very unlikely, key may already be in the table, in this case, we need to undo
-        // the removal - restore the victim, and assume the existing location is where
-        // the item will be inserted.
-        if ( UNLIKELY(e->hash_value == hash_value && key_equals(cache, item_key(cache, e->item_index), key))) {
-            if ( victim_index >= 0 ) {
-                cache->states[victim_index] = victim_state ;
-//                *victim = victim_entry ;
-                cache->item_count++ ;
-            }
+// Eviction policy queues
+static inline void queue_unlink(IhtCache cache, IhtIndex item_index) {
+    struct iht_policy_node *node = &cache->nodes[item_index] ;
+    if ( node->queue == QUEUE_NONE ) return ;
+    struct iht_queue *queue = &cache->queues[node->queue] ;
+    if ( node->prev >= 0 ) cache->nodes[node->prev].next = node->next ; else queue->head = node->next ;
+    if ( node->next >= 0 ) cache->nodes[node->next].prev = node->prev ; else queue->tail = node->prev ;
+    queue->size-- ;
+    node->queue = QUEUE_NONE ;
+}
 
-            bump_counter(&cache->stats.updates, scans);
-            return e ; // Found existing entry
-        }
-        index = next_entry(cache, index) ;
-        e = entry_addr(cache, index) ;
-        scans++ ;
-    };
+static inline void queue_push(IhtCache cache, QueueKind kind, IhtIndex item_index) {
+    struct iht_policy_node *node = &cache->nodes[item_index] ;
+    struct iht_queue *queue = &cache->queues[kind] ;
+    node->prev = -1 ;
+    node->next = queue->head ;
+    if ( queue->head >= 0 ) cache->nodes[queue->head].prev = item_index ; else queue->tail = item_index ;
+    queue->head = item_index ;
+    queue->size++ ;
+    node->queue = (unsigned char) kind ;
+}
 
-    // e is populated with the new entry data
-    *e = (struct iht_entry) { .hash_value = hash_value, .item_index = new_entry_index} ;
-    cache->states[index] = INITIAL_STATE ;
+// S3-FIFO ghost table: fingerprints of keys recently evicted from the small queue.
+static inline uint32_t ghost_fingerprint(IhtHash hash) {
+    return (uint32_t) (hash ^ (hash >> UINT32_WIDTH)) | 1 ;
+}
 
-    bump_counter(&cache->stats.adds, scans) ;
-    cache->item_count++;
-    return e ;
+static inline uint32_t *ghost_entry(IhtCache cache, IhtHash hash) {
+    return &cache->ghost[(hash * KNUTH_GOLD_64 >> UINT32_WIDTH) & cache->ghost_mask] ;
 }
 
-static void store_item(IhtCache cache, int item_index, const void *key, const char *value) {
-    char *entry_space = item_addr(cache, item_index) ;
-    memcpy(entry_space + cache->key_offset, key, cache->key_size) ;
-    memcpy(entry_space + cache->value_offset, value, cache->value_size) ;
-}    
+// GreedyDual heap
+static inline void heap_set(IhtCache cache, IhtIndex pos, struct iht_heap_entry entry) {
+    cache->heap[pos] = entry ;
+    cache->nodes[entry.item_index].prev = pos ;
+}
 
-static IhtEntry calc_new_entry(IhtCache cache, const void *key) {
-    // Logic to calculate and store a new entry
-    if ( !cache->filler ) return NULL ; // No filler available
+static void heap_sift_up(IhtCache cache, IhtIndex pos) {
+    struct iht_heap_entry entry = cache->heap[pos] ;
+    while ( pos > 0 && cache->heap[(pos-1)/2].priority > entry.priority ) {
+        heap_set(cache, pos, cache->heap[(pos-1)/2]) ;
+        pos = (pos-1)/2 ;
+    }
+    heap_set(cache, pos, entry) ;
+}
 
-    alignas(max_align_t) char value_space[cache->value_size] ;
-    if ( !cache->filler(cache->cxt, key, value_space) ) {
-        return NULL ; // Filler failed
+static void heap_sift_down(IhtCache cache, IhtIndex pos) {
+    struct iht_heap_entry entry = cache->heap[pos] ;
+    for (IhtIndex child = 2*pos + 1 ; child < cache->heap_size ; child = 2*pos + 1) {
+        if ( child + 1 < cache->heap_size && cache->heap[child+1].priority < cache->heap[child].priority ) child++ ;
+        if ( cache->heap[child].priority >= entry.priority ) break ;
+        heap_set(cache, pos, cache->heap[child]) ;
+        pos = child ;
     }
+    heap_set(cache, pos, entry) ;
+}
 
-    IhtEntry e = alloc_new_entry(cache, key) ;
-    store_item(cache, e->item_index, key, value_space) ;
+static void heap_push(IhtCache cache, IhtIndex item_index) {
+    IhtIndex pos = cache->heap_size++ ;
+    heap_set(cache, pos, (struct iht_heap_entry) { .priority = cache->nodes[item_index].priority, .item_index = item_index }) ;
+    heap_sift_up(cache, pos) ;
+}
 
-    return e ;
+static void heap_remove(IhtCache cache, IhtIndex item_index) {
+    IhtIndex pos = cache->nodes[item_index].prev ;
+    IhtIndex last = --cache->heap_size ;
+    if ( pos == last ) return ;
+    heap_set(cache, pos, cache->heap[last]) ;
+    heap_sift_up(cache, pos) ;
+    heap_sift_down(cache, cache->nodes[cache->heap[last].item_index].prev) ;
 }
-    
-// Public API functions
 
-IhtCache ihtCacheCreate(int min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt)
-{
-    static bool done ;
-    if (  !done ) {
-        use_crc = __builtin_cpu_supports("sse4.2") ;
-        done = true ;
+// GreedyDual cost classes: class c > 0 stands for fills of [2^(c-1), 2^c) cycles
+static inline unsigned char cost_class(int64_t cycles) {
+    int bits = cycles > 0 ? UINT64_WIDTH - __builtin_clzll((uint64_t) cycles) : 1 ;
+    return (unsigned char) (bits < MAX_COST_CLASS ? bits : MAX_COST_CLASS) ;
+}
+
+static inline uint64_t class_cost(unsigned char cost_class) {
+    return 1ULL << (cost_class - 1) ;
+}
+
+// A lookup hit the entry at slot index
+static inline void policy_hit(IhtCache cache, IhtIndex index) {
+    if ( LIKELY(cache->policy == IHT_EVICT_CLOCK) ) {
+        touch_entry(cache, index) ;
+        return ;
+    }
+    struct iht_policy_node *node = &cache->nodes[slot_item(cache, index)] ;
+    switch ( cache->policy ) {
+        case IHT_EVICT_SIEVE:
+            node->freq = 1 ;
+            break ;
+        case IHT_EVICT_S3FIFO:
+            if ( node->freq < S3FIFO_MAX_FREQ ) node->freq++ ;
+            break ;
+        case IHT_EVICT_GREEDY_DUAL:
+            node->priority = cache->lru_clock + class_cost(node->cost_class) ;
+            break ;
+        default:
+            node->priority = ++cache->lru_clock ;
+            break ;
+    }
+}
+
+// A new entry was added. Entries without a measured filler cost (puts, migrated
+// entries) get the average cost.
+static inline void policy_insert(IhtCache cache, IhtIndex item_index, const struct iht_probe *probe) {
+    if ( LIKELY(cache->policy == IHT_EVICT_CLOCK) ) return ;
+    struct iht_policy_node *node = &cache->nodes[item_index] ;
+    IhtHash hash = probe->hash ;
+    node->freq = 0 ;
+    node->cost_class = probe->cost_class ? probe->cost_class : cost_class(cache->fill_cycles_avg) ;
+    switch ( cache->policy ) {
+        case IHT_EVICT_SIEVE:
+            queue_push(cache, QUEUE_MAIN, item_index) ;
+            break ;
+        case IHT_EVICT_S3FIFO: {
+            uint32_t *ghost = ghost_entry(cache, hash) ;
+            bool seen = *ghost == ghost_fingerprint(hash) ;
+            if ( seen ) *ghost = 0 ;
+            queue_push(cache, seen ? QUEUE_MAIN : QUEUE_SMALL, item_index) ;
+            break ;
+        }
+        case IHT_EVICT_GREEDY_DUAL:
+            node->priority = cache->lru_clock + class_cost(node->cost_class) ;
+            node->queue = QUEUE_NONE ;
+            heap_push(cache, item_index) ;
+            break ;
+        default:
+            node->priority = ++cache->lru_clock ;
+            node->queue = QUEUE_NONE ;
+            break ;
+    }
+}
+
+static inline void policy_remove(IhtCache cache, IhtIndex item_index) {
+    if ( LIKELY(cache->policy == IHT_EVICT_CLOCK) ) return ;
+    if ( cache->policy == IHT_EVICT_GREEDY_DUAL ) {
+        heap_remove(cache, item_index) ;
+        return ;
+    }
+    if ( cache->sieve_hand == item_index ) cache->sieve_hand = cache->nodes[item_index].prev ;
+    queue_unlink(cache, item_index) ;
+}
+
+// TinyLFU sketch. The key hash is mixed again, the 4 rows select their words by
+// double hashing, and the counter within the word from other hash bits.
+static inline uint64_t sketch_word(const struct iht_sketch *sketch, uint64_t h, int row) {
+    uint64_t step = (h >> UINT32_WIDTH) | 1 ;
+    return (h + row*step) & sketch->words_mask ;
+}
+
+static inline int sketch_shift(uint64_t h, int row) {
+    int counter = (int) (((h * KNUTH_GOLD_64) >> (60 - 2*row)) & 3) ;
+    return 4 * (4*row + counter) ;
+}
+
+static inline uint64_t door_bit(const struct iht_sketch *sketch, uint64_t h, int probe) {
+    return (probe ? (h >> 40 | h << 24) : h >> 16) & sketch->door_mask ;
+}
+
+// Halve all counters, and clear the doorkeeper
+static void sketch_age(struct iht_sketch *sketch) {
+    for (uint64_t w = 0 ; w <= sketch->words_mask ; w++) {
+        sketch->counters[w] = (sketch->counters[w] >> 1) & 0x7777777777777777ULL ;
+    }
+    bzero(sketch->doorkeeper, (sketch->door_mask + 1) / CHAR_BIT) ;
+    sketch->additions /= 2 ;
+}
+
+static void sketch_record(struct iht_sketch *sketch, IhtHash hash) {
+    uint64_t h = mix64(hash) ;
+    bool seen = true ;
+    for (int probe = 0 ; probe < 2 ; probe++) {
+        uint64_t bit = door_bit(sketch, h, probe) ;
+        uint64_t mask = 1ULL << (bit % UINT64_WIDTH) ;
+        seen &= (sketch->doorkeeper[bit / UINT64_WIDTH] & mask) != 0 ;
+        sketch->doorkeeper[bit / UINT64_WIDTH] |= mask ;
+    }
+    if ( seen ) {
+        for (int row = 0 ; row < SKETCH_ROWS ; row++) {
+            uint64_t *word = &sketch->counters[sketch_word(sketch, h, row)] ;
+            int shift = sketch_shift(h, row) ;
+            if ( ((*word >> shift) & SKETCH_MAX_COUNT) < SKETCH_MAX_COUNT ) *word += 1ULL << shift ;
+        }
+    }
+    if ( UNLIKELY(++sketch->additions >= sketch->sample_size) ) sketch_age(sketch) ;
+}
+
+static int sketch_estimate(const struct iht_sketch *sketch, IhtHash hash) {
+    uint64_t h = mix64(hash) ;
+    int count = SKETCH_MAX_COUNT ;
+    for (int row = 0 ; row < SKETCH_ROWS ; row++) {
+        int c = (int) ((sketch->counters[sketch_word(sketch, h, row)] >> sketch_shift(h, row)) & SKETCH_MAX_COUNT) ;
+        if ( c < count ) count = c ;
+    }
+    for (int probe = 0 ; probe < 2 ; probe++) {
+        uint64_t bit = door_bit(sketch, h, probe) ;
+        if ( !(sketch->doorkeeper[bit / UINT64_WIDTH] & (1ULL << (bit % UINT64_WIDTH))) ) return count ;
+    }
+    return count + 1 ;
+}
+
+// Eviction candidate, chosen by find_victim
+struct iht_victim {
+    IhtIndex slot ;
+    int scans ;
+    int age ;           // CLOCK age - SLOT_MIN_AGE, -1 for other policies
+} ;
+
+static IhtIndex insert_item(IhtCache cache, struct iht_probe *probe) ;
+
+// Migration after ihtCacheResize: the old table is frozen, migrated entries are
+// marked SLOT_REMOVED, so probe chains through them stay intact.
+static inline char *old_item_addr(IhtCache cache, IhtIndex index) {
+    IhtIndex item_index = table_item(cache->old.entries, cache->old.entry_format, index) ;
+    return ((char *) cache->old.items) + ((ptrdiff_t) cache->item_size*item_index) ;
+}
+
+static inline bool is_old_slot_used(IhtCache cache, IhtIndex index) {
+    return !cache->old.cleared && live_slot(cache->old.states[index], cache->old.epoch) ;
+}
+
+// Find key in the old table. The probe path is walked up to an empty slot, which
+// is valid for all probe modes. Returns the old slot, or -1 if not found.
+static IhtIndex old_probe(IhtCache cache, const void *key, IhtHash hash) {
+    struct iht_old_table *old = &cache->old ;
+    if ( old->cleared ) return -1 ;
+    // The resize changed the table width, hash the key for the old table
+    if ( UNLIKELY(old->wide_index != cache->wide_index) ) hash = key_hash_width(cache, key, old->wide_index) ;
+    IhtHash stored = stored_hash(old->entry_format, old->entries_mask, hash) ;
+    IhtIndex index = (IhtIndex) (hash & old->entries_mask) ;
+    for (IhtIndex scans = 0 ; scans < old->max_entries && old->states[index] != SLOT_EMPTY ; scans++ ) {
+        if ( is_old_slot_used(cache, index) && table_hash(old->entries, old->entry_format, index) == stored &&
+             key_equals(cache, old_item_addr(cache, index) + cache->key_offset, key) ) {
+            return index ;
+        }
+        index = (index + 1) & old->entries_mask ;
+    }
+    return -1 ;
+}
+
+// Move the entry at the old slot index to the current table, at the insert position
+// in probe. Returns the new item index.
+static IhtIndex move_old_slot(IhtCache cache, IhtIndex index, struct iht_probe *probe) {
+    IhtIndex item_index = insert_item(cache, probe) ;
+    memcpy(item_addr(cache, item_index), old_item_addr(cache, index), cache->item_size) ;
+    cache->old.states[index] = SLOT_REMOVED ;
+    cache->old.count-- ;
+    return item_index ;
+}
+
+// Key was not found in the current table, move it from the old table if it is there.
+static IhtIndex migrate_key(IhtCache cache, const void *key, struct iht_probe *probe) {
+    IhtIndex index = old_probe(cache, key, probe->hash) ;
+    if ( index < 0 ) return -1 ;
+    return move_old_slot(cache, index, probe) ;
+}
+
+static void migrate_slot(IhtCache cache, IhtIndex index) {
+    unsigned char state = cache->old.states[index] ;
+    if ( !value_slot(state) ) return ;
+    if ( is_old_slot_used(cache, index) ) {
+        char *item = old_item_addr(cache, index) ;
+        // Narrow entries keep only part of the hash, the key is hashed again
+        struct iht_probe probe = { .hash = table_hash(cache->old.entries, cache->old.entry_format, index) } ;
+        if ( cache->old.entry_format != cache->entry_format || cache->old.entry_format == ENTRY_NARROW ) {
+            probe.hash = key_hash(cache, item + cache->key_offset) ;
+        }
+        (void) probe_slot(cache, item + cache->key_offset, &probe, KEY_GENERIC) ;
+        (void) move_old_slot(cache, index, &probe) ;
+        return ;
+    }
+    // Stale (removed) entry, only the value has to be released
+    if ( cache->value_destroyer ) {
+        cache->value_destroyer(cache->cxt, old_item_addr(cache, index) + cache->value_offset) ;
+    }
+    cache->old.states[index] = SLOT_REMOVED ;
+}
+
+// Migrate the next n slots of the old table, and release it when done.
+static void migrate_step(IhtCache cache, IhtIndex n) {
+    struct iht_old_table *old = &cache->old ;
+    IhtIndex end = old->migrate_index + n ;
+    if ( end > old->max_entries ) end = old->max_entries ;
+    for (IhtIndex index = old->migrate_index ; index < end ; index++ ) {
+        migrate_slot(cache, index) ;
+    }
+    old->migrate_index = end ;
+    if ( end == old->max_entries ) drop_old_table(cache) ;
+}
+
+static bool old_remove(IhtCache cache, const void *key, IhtHash hash) {
+    IhtIndex index = old_probe(cache, key, hash) ;
+    if ( index < 0 ) return false ;
+    if ( cache->value_destroyer ) {
+        cache->value_destroyer(cache->cxt, old_item_addr(cache, index) + cache->value_offset) ;
+    }
+    cache->old.states[index] = SLOT_REMOVED ;
+    cache->old.count-- ;
+    return true ;
+}
+
+// Look up key, returns the item index, or -1 if not found. In this case
+// probe holds the insert position for the key.
+static inline IhtIndex lookup_item_probe(IhtCache cache, const void *key, IhtHash hash, struct iht_probe *probe, KeyKind kind)
+{
+    if ( UNLIKELY(cache->old.states != NULL) ) migrate_step(cache, MIGRATE_STEP) ;
+    if ( UNLIKELY(cache->admission != IHT_ADMIT_ALL) ) sketch_record(&cache->sketch, hash) ;
+    probe->hash = hash ;
+    probe->cost_class = 0 ;
+    IhtIndex index = probe_slot(cache, key, probe, kind) ;
+    if ( LIKELY(index >= 0) ) {
+        count_stat(cache, STAT_HITS, probe->scans) ;
+        policy_hit(cache, index) ;
+        return slot_item(cache, index) ;
+    }
+    if ( UNLIKELY(cache->old.states != NULL) ) {
+        IhtIndex item_index = migrate_key(cache, key, probe) ;
+        if ( item_index >= 0 ) {
+            count_stat(cache, STAT_HITS, probe->scans) ;
+            return item_index ;
+        }
+    }
+    count_stat(cache, STAT_MISSES, probe->scans);
+    return -1; // Not found
+}
+
+static inline IhtIndex lookup_item(IhtCache cache, const void *key, struct iht_probe *probe) {
+    return lookup_item_probe(cache, key, key_hash(cache, key), probe, KEY_GENERIC) ;
+}
+
+// With Robin Hood probing, each eviction search window starts at a pseudo random slot
+// (xorshift), so evictions are spread over the table. With a sweeping CLOCK hand, the
+// hand region is emptied while inserts keep filling the rest of the table, creating
+// long clusters at the high load factors this mode is used for.
+static inline IhtIndex next_evict_index(IhtCache cache) {
+    uint64_t x = cache->evict_seed ;
+    x ^= x << 13 ;
+    x ^= x >> 7 ;
+    x ^= x << 17 ;
+    cache->evict_seed = x ;
+    return (IhtIndex) ((x >> UINT32_WIDTH) | (x << UINT32_WIDTH)) & cache->entries_mask ;
+}
+
+static void clock_victim(IhtCache cache, struct iht_victim *victim, bool commit) {
+    SlotState victim_state = SLOT_MAX_AGE + 1 ;
+    int scans = 0 ;
+    IhtIndex index = cache->evict_index ;
+    IhtIndex victim_index = index ;
+
+    for (int search = MAX_EVICTION_SEARCH ; search > 0 ; scans++, index = next_entry(cache, index) ) {
+        unsigned char slot_state = cache->states[index];
+        if ( !live_slot(slot_state, cache->epoch) ) continue ;
+        if ( slot_age(slot_state) < victim_state ) {
+            victim_index = index ;
+            victim_state = slot_age(slot_state) ;
+            if ( victim_state == SLOT_MIN_AGE ) {
+                search = 0 ;
+                continue ;
+            }
+        } ;
+        if ( commit ) cache->states[index] = slot_state - 1 ;
+        // Limit scan to slow evictions
+        search-- ;
+    }
+    if ( commit ) cache->evict_index = cache->probe_mode == IHT_PROBE_ROBIN_HOOD ? next_evict_index(cache) : index ;
+    *victim = (struct iht_victim) { .slot = victim_index, .scans = scans, .age = victim_state - SLOT_MIN_AGE } ;
+}
+
+// Slot of a live item, found by probing for its key
+static IhtIndex item_slot(IhtCache cache, IhtIndex item_index, IhtHash *hash) {
+    const void *key = item_key(cache, item_index) ;
+    struct iht_probe probe = { .hash = key_hash(cache, key) } ;
+    *hash = probe.hash ;
+    return probe_slot(cache, key, &probe, KEY_GENERIC) ;
+}
+
+// SIEVE: the hand moves from the tail toward the head, clearing visited marks, and
+// stops at the first entry that was not visited. Entries are never reordered. Without
+// commit, the marks are kept: after a full turn, the hand would stop at its start.
+static IhtIndex sieve_victim(IhtCache cache, int *scans, bool commit) {
+    struct iht_queue *queue = &cache->queues[QUEUE_MAIN] ;
+    IhtIndex start = cache->sieve_hand >= 0 ? cache->sieve_hand : queue->tail ;
+    IhtIndex item_index = start ;
+    for ( ; cache->nodes[item_index].freq ; (*scans)++ ) {
+        if ( commit ) {
+            cache->nodes[item_index].freq = 0 ;
+        } else if ( item_index == start && *scans > 0 ) {
+            break ;
+        }
+        item_index = cache->nodes[item_index].prev ;
+        if ( item_index < 0 ) item_index = queue->tail ;
+    }
+    if ( commit ) cache->sieve_hand = cache->nodes[item_index].prev ;
+    return item_index ;
+}
+
+// S3-FIFO: entries leaving the small queue move to the main queue if they were hit,
+// or are evicted and remembered in the ghost table. Entries leaving the main queue
+// are reinserted while their hit count is above zero, decreasing it.
+static IhtIndex s3fifo_victim(IhtCache cache, int *scans) {
+    struct iht_queue *small_queue = &cache->queues[QUEUE_SMALL] ;
+    struct iht_queue *main_queue = &cache->queues[QUEUE_MAIN] ;
+    for ( ;; (*scans)++ ) {
+        bool from_small = small_queue->size > 0 && (small_queue->size >= cache->small_target || main_queue->size == 0) ;
+        IhtIndex item_index = from_small ? small_queue->tail : main_queue->tail ;
+        struct iht_policy_node *node = &cache->nodes[item_index] ;
+        if ( !node->freq ) return item_index ;
+        node->freq = from_small ? 0 : node->freq - 1 ;
+        queue_unlink(cache, item_index) ;
+        queue_push(cache, QUEUE_MAIN, item_index) ;
+    }
+}
+
+// Sampled LRU: the least recently used of LRU_SAMPLES entries, each the first used
+// slot at or after a random slot. Without commit, the same slots are sampled next time.
+static IhtIndex sampled_lru_victim(IhtCache cache, int *scans, bool commit) {
+    uint64_t seed = cache->evict_seed ;
+    IhtIndex victim_index = -1 ;
+    uint64_t victim_priority = UINT64_MAX ;
+    for (int sample = 0 ; sample < LRU_SAMPLES ; sample++) {
+        IhtIndex index = next_evict_index(cache) ;
+        for ( ; !is_slot_used(cache, index) ; (*scans)++ ) index = next_entry(cache, index) ;
+        uint64_t priority = cache->nodes[slot_item(cache, index)].priority ;
+        if ( priority < victim_priority ) {
+            victim_index = index ;
+            victim_priority = priority ;
+        }
+    }
+    if ( !commit ) cache->evict_seed = seed ;
+    return victim_index ;
+}
+
+// GreedyDual: the entry with the lowest H = L + cost, where H is set when the entry is
+// added or hit, and L is raised to the H of each victim. Entries that were expensive
+// to fill stay longer, but not forever once they are not used. Hits only update the
+// node, an entry found at the top of the heap with an old H is moved down first.
+static IhtIndex greedy_dual_victim(IhtCache cache, int *scans, bool commit) {
+    struct iht_heap_entry *top = &cache->heap[0] ;
+    for ( ; cache->nodes[top->item_index].priority != top->priority ; (*scans)++ ) {
+        top->priority = cache->nodes[top->item_index].priority ;
+        heap_sift_down(cache, 0) ;
+    }
+    if ( commit ) cache->lru_clock = top->priority ;
+    return top->item_index ;
+}
+
+// Choose the entry to evict, by the eviction policy. The eviction is counted when
+// the victim is removed. The admission filter looks at the victim without commit: the
+// CLOCK ages and hand, the SIEVE marks and hand, the S3-FIFO ghosts and the GreedyDual
+// L are left as they were, and the same victim is chosen again with commit when an
+// entry is evicted. S3-FIFO and GreedyDual may move entries in their queue or heap,
+// as any later choice would.
+static void find_victim(IhtCache cache, struct iht_victim *victim, bool commit) {
+    if ( LIKELY(cache->policy == IHT_EVICT_CLOCK) ) {
+        clock_victim(cache, victim, commit) ;
+        return ;
+    }
+    int scans = 0 ;
+    IhtIndex index ;
+    if ( cache->policy == IHT_EVICT_SAMPLED_LRU ) {
+        index = sampled_lru_victim(cache, &scans, commit) ;
+    } else {
+        IhtIndex item_index = cache->policy == IHT_EVICT_SIEVE ? sieve_victim(cache, &scans, commit) :
+            cache->policy == IHT_EVICT_S3FIFO ? s3fifo_victim(cache, &scans) : greedy_dual_victim(cache, &scans, commit) ;
+        IhtHash hash ;
+        index = item_slot(cache, item_index, &hash) ;
+        if ( commit && cache->nodes[item_index].queue == QUEUE_SMALL ) {
+            *ghost_entry(cache, hash) = ghost_fingerprint(hash) ;
+        }
+    }
+    *victim = (struct iht_victim) { .slot = index, .scans = scans, .age = -1 } ;
+}
+
+// Complete content of a slot, used when entries are moved between slots.
+struct iht_slot {
+    IhtHash hash_value ;
+    IhtIndex item_index ;
+    unsigned char state ;
+    struct iht_item item ;      // inline items only
+} ;
+
+static inline void load_slot(IhtCache cache, IhtIndex index, struct iht_slot *slot) {
+    slot->hash_value = entry_hash(cache, index) ;
+    slot->item_index = entry_item(cache, index) ;
+    slot->state = cache->states[index] ;
+    if ( cache->inline_items ) slot->item = cache->items[index] ;
+}
+
+static inline void store_slot(IhtCache cache, IhtIndex index, struct iht_slot *slot) {
+    if ( cache->inline_items ) {
+        cache->items[index] = slot->item ;
+        slot->item_index = index ;
+    }
+    set_entry(cache, index, slot->hash_value, slot->item_index) ;
+    set_slot_state(cache, index, slot->state) ;
+}
+
+static inline void move_slot(IhtCache cache, IhtIndex from, IhtIndex to) {
+    struct iht_slot slot ;
+    load_slot(cache, from, &slot) ;
+    store_slot(cache, to, &slot) ;
+}
+
+// Removed items (indirect layout) are kept on a free list, linked through the item
+// memory. Items [item_top, max_items) were never used.
+static inline void free_item(IhtCache cache, IhtIndex item_index) {
+    memcpy(item_addr(cache, item_index), &cache->free_item, sizeof(cache->free_item)) ;
+    cache->free_item = item_index ;
+}
+
+static inline void destroy_value(IhtCache cache, IhtIndex item_index) {
+    if ( cache->value_destroyer ) cache->value_destroyer(cache->cxt, item_value(cache, item_index)) ;
+}
+
+// Release the value of a stale slot (from before the last epoch change), and
+// mark the slot empty. No-op for other slots.
+static inline void reclaim_slot(IhtCache cache, IhtIndex index) {
+    unsigned char state = cache->states[index] ;
+    if ( LIKELY(!value_slot(state) || live_slot(state, cache->epoch)) ) return ;
+    IhtIndex item_index = slot_item(cache, index) ;
+    destroy_value(cache, item_index) ;
+    if ( !cache->inline_items ) free_item(cache, item_index) ;
+    set_slot_state(cache, index, SLOT_EMPTY) ;
+}
+
+// Lazy cleanup after an epoch change: reclaim the next n slots.
+static void sweep_stale(IhtCache cache, IhtIndex n) {
+    IhtIndex end = cache->sweep_index + n ;
+    if ( end > cache->max_entries ) end = cache->max_entries ;
+    for (IhtIndex index = cache->sweep_index ; index < end ; index++ ) {
+        reclaim_slot(cache, index) ;
+    }
+    cache->sweep_index = end ;
+}
+
+static inline IhtIndex alloc_item(IhtCache cache) {
+    while ( UNLIKELY(cache->free_item < 0) ) {
+        if ( cache->item_top < cache->max_items ) return cache->item_top++ ;
+        // All free items are still held by stale slots
+        sweep_stale(cache, SWEEP_STEP) ;
+    }
+    IhtIndex item_index = cache->free_item ;
+    memcpy(&cache->free_item, item_addr(cache, item_index), sizeof(cache->free_item)) ;
+    return item_index ;
+}
+
+// Robin Hood insert: store carry at index, and push the displaced entries forward,
+// each one taking the place of the first entry closer to its home slot.
+static void robin_hood_place(IhtCache cache, IhtIndex index, struct iht_slot *carry)
+{
+    IhtIndex dist = (index - hash_entry(cache, carry->hash_value)) & cache->entries_mask ;
+    while ( is_slot_used(cache, index) ) {
+        IhtIndex resident_dist = slot_distance(cache, index) ;
+        if ( resident_dist < dist ) {
+            struct iht_slot resident ;
+            load_slot(cache, index, &resident) ;
+            store_slot(cache, index, carry) ;
+            *carry = resident ;
+            dist = resident_dist ;
+        }
+        index = next_entry(cache, index) ;
+        dist++ ;
+    }
+    reclaim_slot(cache, index) ;
+    store_slot(cache, index, carry) ;
+}
+
+// Robin Hood delete: shift the following entries of the chain one slot back, until an
+// empty slot or an entry at its home slot. Returns the slot that was left empty.
+static IhtIndex robin_hood_delete(IhtCache cache, IhtIndex index)
+{
+    IhtIndex next = next_entry(cache, index) ;
+    while ( is_slot_used(cache, next) && slot_distance(cache, next) > 0 ) {
+        move_slot(cache, next, index) ;
+        index = next ;
+        next = next_entry(cache, next) ;
+    }
+    set_slot_state(cache, index, SLOT_EMPTY) ;
+    return index ;
+}
+
+// Find the insert position for a key that is known to be missing.
+static IhtIndex robin_hood_insert_slot(IhtCache cache, struct iht_probe *probe)
+{
+    IhtIndex index = hash_entry(cache, probe->hash) ;
+    IhtIndex dist = 0 ;
+    while ( is_slot_used(cache, index) && slot_distance(cache, index) >= dist ) {
+        index = next_entry(cache, index) ;
+        dist++ ;
+    }
+    probe->slot = index ;
+    probe->scans = dist ;
+    return index ;
+}
+
+// Offset of index along the probe path starting at home.
+static inline IhtIndex path_offset(IhtCache cache, IhtIndex home, IhtIndex index) {
+    return (index - home) & cache->entries_mask ;
+}
+
+// Linear probing delete, without tombstones (Knuth, Algorithm R): move back each
+// following entry of the chain whose probe path goes through the emptied slot.
+// Returns the slot that was left empty.
+static IhtIndex linear_delete(IhtCache cache, IhtIndex index)
+{
+    for (IhtIndex next = next_entry(cache, index) ; is_slot_used(cache, next) ; next = next_entry(cache, next) ) {
+        IhtIndex home = hash_entry(cache, entry_hash(cache, next)) ;
+        if ( path_offset(cache, home, index) < path_offset(cache, home, next) ) {
+            move_slot(cache, next, index) ;
+            index = next ;
+        }
+    }
+    set_slot_state(cache, index, SLOT_EMPTY) ;
+    return index ;
+}
+
+static inline IhtIndex delete_slot(IhtCache cache, IhtIndex index)
+{
+    if ( cache->probe_mode == IHT_PROBE_ROBIN_HOOD ) {
+        return robin_hood_delete(cache, index) ;
+    }
+    return linear_delete(cache, index) ;
+}
+
+// Remove the entry at index. Returns the slot that was left empty.
+static IhtIndex remove_slot(IhtCache cache, IhtIndex index)
+{
+    IhtIndex item_index = slot_item(cache, index) ;
+    destroy_value(cache, item_index) ;
+    policy_remove(cache, item_index) ;
+    IhtIndex last = delete_slot(cache, index) ;
+    if ( !cache->inline_items ) free_item(cache, item_index) ;
+    cache->item_count-- ;
+    return last ;
+}
+
+// Insert a key that is known to be missing, at the free slot found by the failed
+// lookup. If the cache is full, a victim is evicted first. Returns the item index.
+static IhtIndex insert_item(IhtCache cache, struct iht_probe *probe)
+{
+    IhtIndex index = probe->slot ;
+
+    if ( LIKELY(cache->item_count >= cache->max_items )) {
+        struct iht_victim victim ;
+        find_victim(cache, &victim, true) ;
+        count_op(cache, STAT_EVICTIONS, victim.scans, victim.age) ;
+        IhtIndex victim_index = victim.slot ;
+        IhtIndex home = hash_entry(cache, probe->hash) ;
+        IhtIndex last = remove_slot(cache, victim_index) ;
+        if ( cache->probe_mode == IHT_PROBE_ROBIN_HOOD ) {
+            // The backward shift may move entries on the probe path of the key, in this
+            // case, find the insert position again.
+            if ( path_offset(cache, home, victim_index) <= path_offset(cache, home, index) ||
+                 path_offset(cache, victim_index, home) <= path_offset(cache, victim_index, last) ) {
+                index = robin_hood_insert_slot(cache, probe) ;
+            }
+        } else if ( path_offset(cache, home, last) < path_offset(cache, home, index) ) {
+            // The slot left empty is on the probe path of the key, it is now the first free slot.
+            index = last ;
+            probe->scans = path_offset(cache, home, index) ;
+        }
+    }
+
+    if ( UNLIKELY(cache->sweep_index < cache->max_entries) ) {
+        sweep_stale(cache, SWEEP_STEP) ;
+    }
+    if ( !is_slot_used(cache, index) ) reclaim_slot(cache, index) ;
+
+    // With inline items, the item is stored in the slot itself.
+    IhtIndex new_item_index = cache->inline_items ? index : alloc_item(cache) ;
+    policy_insert(cache, new_item_index, probe) ;
+
+    unsigned char state = hash_tag(probe->hash, cache->tag_shift) | cache->epoch | INITIAL_STATE ;
+    if ( cache->probe_mode == IHT_PROBE_ROBIN_HOOD && is_slot_used(cache, index) ) {
+        struct iht_slot carry = { .hash_value = probe->hash, .item_index = new_item_index, .state = state } ;
+        robin_hood_place(cache, index, &carry) ;
+    } else {
+        set_entry(cache, index, probe->hash, new_item_index) ;
+        set_slot_state(cache, index, state) ;
+    }
+
+    count_stat(cache, STAT_ADDS, probe->scans) ;
+    cache->item_count++;
+    return new_item_index ;
+}
+
+// Returns the item index for key, allocating a new entry (and evicting) if needed.
+static IhtIndex alloc_new_item(IhtCache cache, const void *key)
+{
+    struct iht_probe probe = { .hash = key_hash(cache, key) } ;
+    IhtIndex index = probe_slot(cache, key, &probe, KEY_GENERIC) ;
+    if ( UNLIKELY(index >= 0) ) {
+        count_stat(cache, STAT_UPDATES, probe.scans);
+        return slot_item(cache, index) ; // Found existing entry
+    }
+    if ( UNLIKELY(cache->old.states != NULL) ) {
+        IhtIndex item_index = migrate_key(cache, key, &probe) ;
+        if ( item_index >= 0 ) {
+            count_stat(cache, STAT_UPDATES, probe.scans);
+            return item_index ;
+        }
+    }
+    return insert_item(cache, &probe) ;
+}
+
+static void store_item(IhtCache cache, IhtIndex item_index, const void *key, const char *value) {
+    char *entry_space = item_addr(cache, item_index) ;
+    copy_key(cache, entry_space + cache->key_offset, key) ;
+    copy_value(cache, entry_space + cache->value_offset, value) ;
+}    
+
+// TinyLFU admission: a new key replaces the victim only if it is used more often
+static bool admit_key(IhtCache cache, IhtHash hash, IhtIndex victim_index) {
+    IhtHash victim_hash = key_hash(cache, item_key(cache, slot_item(cache, victim_index))) ;
+    return sketch_estimate(&cache->sketch, hash) > sketch_estimate(&cache->sketch, victim_hash) ;
+}
+
+// Keep a value rejected by the admission filter in the item after the cache items,
+// until the next rejected value. Returns the item index.
+static IhtIndex bypass_item(IhtCache cache, const void *key, const char *value) {
+    release_bypass(cache) ;
+    IhtIndex item_index = item_slots(cache) ;
+    store_item(cache, item_index, key, value) ;
+    cache->bypass_held = true ;
+    count_stat(cache, STAT_REJECTS, 0) ;
+    return item_index ;
+}
+
+// Add the filled value of a key that was not found by the lookup that set probe.
+// Returns the item, or the bypass item if the admission filter rejects the key.
+static IhtIndex add_filled_item(IhtCache cache, const void *key, struct iht_probe *probe, const char *value) {
+    if ( UNLIKELY(cache->admission != IHT_ADMIT_ALL) && cache->item_count >= cache->max_items ) {
+        // Rejected keys leave the eviction policy state as it was
+        struct iht_victim victim ;
+        find_victim(cache, &victim, false) ;
+        if ( !admit_key(cache, probe->hash, victim.slot) ) return bypass_item(cache, key, value) ;
+    }
+
+    IhtIndex item_index = insert_item(cache, probe) ;
+    store_item(cache, item_index, key, value) ;
+    return item_index ;
+}
+
+// Fill the value for a key that was not found by the lookup that set probe.
+static IhtIndex calc_new_item(IhtCache cache, const void *key, struct iht_probe *probe) {
+    // Logic to calculate and store a new entry
+    if ( !cache->filler ) return -1 ; // No filler available
+
+    alignas(max_align_t) char value_space[cache->value_size] ;
+    uint64_t start = cache->time_fills ? __rdtsc() : 0 ;
+    if ( !cache->filler(cache->cxt, key, value_space) ) {
+        return -1 ; // Filler failed
+    }
+    if ( UNLIKELY(cache->time_fills) ) {
+        int64_t cycles = (int64_t) (__rdtsc() - start) ;
+        probe->cost_class = cost_class(cycles) ;
+        cache->fill_cycles_avg += (cycles - cache->fill_cycles_avg) / FILL_COST_SMOOTHING ;
+        cache->last_fill_cycles = cycles ;
+        count_fill(cache, cycles) ;
+    }
+    return add_filled_item(cache, key, probe, value_space) ;
+}
+
+// Lookup of the Get and Fetch functions: returns the item for key, filled if missing,
+// or -1 if the filler is not available or fails.
+static inline IhtIndex cached_get(IhtCache cache, const void *key, IhtHash hash, KeyKind kind) {
+    struct iht_probe probe ;
+    IhtIndex item_index = lookup_item_probe(cache, key, hash, &probe, kind) ;
+    if ( UNLIKELY(item_index < 0) ) item_index = calc_new_item(cache, key, &probe) ;
+    return item_index ;
+}
+
+// Adaptive bypass: call the filler without using the cache. The value is held in the
+// item after the cache items, like a rejected value.
+static IhtIndex pass_through(IhtCache cache, const void *key) {
+    if ( !cache->filler ) return -1 ;
+    release_bypass(cache) ;
+    IhtIndex item_index = item_slots(cache) ;
+    if ( !cache->filler(cache->cxt, key, item_value(cache, item_index)) ) return -1 ;
+    cache->bypass_held = true ;
+    count_stat(cache, STAT_PASSES, 0) ;
+    return item_index ;
+}
+
+static void start_bypass_phase(IhtCache cache, BypassPhase phase, int64_t length) {
+    struct iht_bypass *bypass = &cache->bypass ;
+    int64_t pass_period = bypass->pass_period ;
+    *bypass = (struct iht_bypass) { .phase = phase, .countdown = length, .pass_period = pass_period } ;
+    update_fill_timing(cache) ;
+}
+
+// After a timed window, pass lookups to the filler if the cost per lookup through the
+// cache is higher than the cost of a filler call. Consecutive pass through periods
+// are doubled.
+static void next_bypass_phase(IhtCache cache) {
+    struct iht_bypass *bypass = &cache->bypass ;
+    if ( bypass->phase != BYPASS_MEASURE ) {
+        start_bypass_phase(cache, BYPASS_MEASURE, BYPASS_WINDOW) ;
+        return ;
+    }
+    // Without misses in the window, the filler cost is the moving average of earlier fills
+    int64_t lookups = bypass->hits + bypass->misses ;
+    double filled = bypass->misses ? (double) bypass->fill_cycles / bypass->misses : (double) cache->fill_cycles_avg ;
+    bool pass = false ;
+    if ( lookups > 0 && filled > 0 ) {
+        double cached = (double) (bypass->hit_cycles + bypass->miss_cycles) / lookups ;
+        pass = cached > filled * BYPASS_MARGIN ;
+    }
+    if ( pass ) {
+        start_bypass_phase(cache, BYPASS_PASS, bypass->pass_period) ;
+        if ( bypass->pass_period < BYPASS_MAX_PERIOD ) bypass->pass_period *= 2 ;
+    } else {
+        bypass->pass_period = BYPASS_PERIOD ;
+        start_bypass_phase(cache, BYPASS_CACHE, BYPASS_PERIOD) ;
+    }
+}
+
+static IhtIndex adaptive_get(IhtCache cache, const void *key, IhtHash hash, KeyKind kind) {
+    struct iht_bypass *bypass = &cache->bypass ;
+    if ( UNLIKELY(bypass->countdown <= 0) ) next_bypass_phase(cache) ;
+    bypass->countdown-- ;
+    if ( bypass->phase == BYPASS_PASS ) return pass_through(cache, key) ;
+    if ( bypass->phase == BYPASS_CACHE ) return cached_get(cache, key, hash, kind) ;
+
+    cache->last_fill_cycles = -1 ;
+    uint64_t start = __rdtsc() ;
+    IhtIndex item_index = cached_get(cache, key, hash, kind) ;
+    int64_t cycles = (int64_t) (__rdtsc() - start) ;
+    if ( cache->last_fill_cycles >= 0 ) {
+        bypass->misses++ ;
+        bypass->miss_cycles += cycles ;
+        bypass->fill_cycles += cache->last_fill_cycles ;
+    } else if ( item_index >= 0 ) {
+        bypass->hits++ ;
+        bypass->hit_cycles += cycles ;
+    }
+    return item_index ;
+}
+
+static inline IhtIndex get_item(IhtCache cache, const void *key, IhtHash hash, KeyKind kind) {
+    if ( UNLIKELY(cache->adaptive_bypass) ) return adaptive_get(cache, key, hash, kind) ;
+    return cached_get(cache, key, hash, kind) ;
+}
+    
+// Batched lookups: keys are processed in stages of BATCH_STAGE. All hashes in the
+// stage are computed and the home slots prefetched, then (indirect layout) the items
+// of the likely hits are prefetched, and only then the lookups are resolved.
+static inline void prefetch_slot(IhtCache cache, IhtHash hash) {
+    IhtIndex index = hash_entry(cache, hash) ;
+    __builtin_prefetch(cache->states + index) ;
+    if ( cache->inline_items ) {
+        __builtin_prefetch(&cache->items[index]) ;
+    } else {
+        __builtin_prefetch(entry_addr(cache, index)) ;
+    }
+}
+
+static inline void prefetch_item(IhtCache cache, IhtHash hash) {
+    if ( cache->inline_items ) return ;
+    IhtIndex index = hash_entry(cache, hash) ;
+    if ( is_slot_used(cache, index) && entry_hash_matches(cache, index, probe_hash(cache, hash)) ) {
+        __builtin_prefetch(item_addr(cache, entry_item(cache, index))) ;
+    }
+}
+
+static inline void set_miss(uint64_t *miss_mask, int pos) {
+    if ( miss_mask ) miss_mask[pos / UINT64_WIDTH] |= 1ULL << (pos % UINT64_WIDTH) ;
+}
+
+static inline int mask_words(int n) {
+    return (n + UINT64_WIDTH - 1) / UINT64_WIDTH ;
+}
+
+// With a batch filler, the misses of a batched get are collected by the lookups, and
+// filled together after the lookups of the batch.
+static void reserve_batch_fill(IhtCache cache, int n) {
+    struct iht_batch_fill *batch = &cache->batch ;
+    batch->count = 0 ;
+    if ( n <= batch->capacity ) return ;
+    int capacity = mask_words(n) * UINT64_WIDTH ;
+    batch->positions = realloc(batch->positions, capacity * sizeof(*batch->positions)) ;
+    batch->hashes = realloc(batch->hashes, capacity * sizeof(*batch->hashes)) ;
+    batch->keys = realloc(batch->keys, (size_t) capacity * cache->key_size) ;
+    batch->values = realloc(batch->values, (size_t) capacity * cache->value_size) ;
+    batch->ok_mask = realloc(batch->ok_mask, mask_words(capacity) * sizeof(*batch->ok_mask)) ;
+    batch->capacity = capacity ;
+}
+
+static void free_batch_fill(IhtCache cache) {
+    struct iht_batch_fill *batch = &cache->batch ;
+    free(batch->positions) ;
+    free(batch->hashes) ;
+    free(batch->keys) ;
+    free(batch->values) ;
+    free(batch->ok_mask) ;
+    *batch = (struct iht_batch_fill) { 0 } ;
+}
+
+// Lookup of the batched gets
+static inline IhtIndex batch_get_item(IhtCache cache, const void *key, IhtHash hash, KeyKind kind, int pos) {
+    if ( LIKELY(!cache->batch_filler) ) return get_item(cache, key, hash, kind) ;
+    struct iht_probe probe ;
+    IhtIndex item_index = lookup_item_probe(cache, key, hash, &probe, kind) ;
+    if ( item_index < 0 ) {
+        struct iht_batch_fill *batch = &cache->batch ;
+        batch->positions[batch->count] = pos ;
+        batch->hashes[batch->count] = hash ;
+        copy_key(cache, batch->keys + (ptrdiff_t) batch->count * cache->key_size, key) ;
+        batch->count++ ;
+    }
+    return item_index ;
+}
+
+// Fill the misses collected by the lookups with one call of the batch filler, and add
+// the values. The filler gets the keys and values packed (key_size and value_size
+// bytes). The table changed since the lookups: each key is probed again, and may be
+// found if it was repeated in the batch. Returns the number of values filled.
+static int fill_batch(IhtCache cache, KeyKind kind, const void *keys, void *values_out, uint64_t *miss_mask)
+{
+    struct iht_batch_fill *batch = &cache->batch ;
+    int n = batch->count ;
+    if ( n == 0 ) return 0 ;
+    bzero(batch->ok_mask, mask_words(n) * sizeof(*batch->ok_mask)) ;
+    uint64_t start = cache->time_fills ? __rdtsc() : 0 ;
+    cache->batch_filler(cache->cxt, batch->keys, n, batch->values, batch->ok_mask) ;
+    int64_t cycles = cache->time_fills ? (int64_t) (__rdtsc() - start) : 0 ;
+
+    int filled = 0 ;
+    for (int j = 0 ; j < n ; j++) filled += (int) (batch->ok_mask[j / UINT64_WIDTH] >> (j % UINT64_WIDTH) & 1) ;
+    unsigned char cost = 0 ;
+    if ( UNLIKELY(cache->time_fills) && filled ) {
+        // Each value is charged an equal share of the call
+        int64_t value_cycles = cycles / filled ;
+        cost = cost_class(value_cycles) ;
+        cache->fill_cycles_avg += (value_cycles - cache->fill_cycles_avg) / FILL_COST_SMOOTHING ;
+        count_fill(cache, cycles) ;
+    }
+
+    for (int j = 0 ; j < n ; j++) {
+        if ( !(batch->ok_mask[j / UINT64_WIDTH] >> (j % UINT64_WIDTH) & 1) ) continue ;
+        int pos = batch->positions[j] ;
+        const void *key = kind == KEY_FAST ? (const void *) &((const IhtCacheFastKey *) keys)[pos] :
+            (const char *) keys + (ptrdiff_t) pos * cache->key_size ;
+        struct iht_probe probe = { .hash = batch->hashes[j] } ;
+        IhtIndex item_index = probe_slot(cache, key, &probe, kind) ;
+        if ( item_index >= 0 ) {
+            item_index = slot_item(cache, item_index) ;
+        } else if ( UNLIKELY(cache->old.states != NULL) ) {
+            item_index = migrate_key(cache, key, &probe) ;
+        }
+        if ( item_index < 0 ) {
+            probe.cost_class = cost ;
+            item_index = add_filled_item(cache, key, &probe, batch->values + (ptrdiff_t) j * cache->value_size) ;
+        }
+        if ( kind == KEY_FAST ) {
+            ((IhtCacheFastValue *) values_out)[pos] = cache->items[item_index].value ;
+        } else {
+            copy_value(cache, (char *) values_out + (ptrdiff_t) pos * cache->value_size, item_value(cache, item_index)) ;
+        }
+        if ( miss_mask ) miss_mask[pos / UINT64_WIDTH] &= ~(1ULL << (pos % UINT64_WIDTH)) ;
+    }
+    batch->count = 0 ;
+    return filled ;
+}
+
+// Public API functions
+
+IhtCache ihtCacheCreate(int min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt)
+{
+    return ihtCacheCreate64(min_capacity, key_size, value_sz, filler, cxt) ;
+}
+
+IhtCache ihtCacheCreate64(int64_t min_capacity, int key_size, int value_sz, ihtCacheFiller filler, void *cxt)
+{
+    IhtCache cache = calloc(1, sizeof(*cache));
+    cache->min_capacity = min_capacity;
+    cache->key_size = key_size;
+    cache->value_size = value_sz;
+    cache->max_load_factor = DEFAULT_LOAD_FACTOR;
+    cache->filler = filler;
+    cache->cxt = cxt;
+
+    setup(cache);
+    allocate(cache);
+
+    return cache;
+}
+
+void ihtCacheRemoveAll(IhtCache cache)
+{
+    // Finish the sweep of the previous epoch, before its slots become live again
+    sweep_stale(cache, cache->max_entries) ;
+    cache->epoch ^= STATE_EPOCH_BIT ;
+    cache->item_count = 0 ;
+    cache->sweep_index = 0 ;
+    reset_policy(cache) ;
+    update_view(cache) ;
+    // Values in the old table are released as the migration continues
+    cache->old.cleared = true ;
+    cache->old.count = 0 ;
+}
+
+void ihtCacheDestroy(IhtCache cache) 
+{
+    remove_all(cache);
+    deallocate(cache);
+    if ( cache->cxt_destroyer ) {
+        cache->cxt_destroyer(cache->cxt);
+    }
+    free(cache->na_value);
+    free(cache->stripes);
+    free_batch_fill(cache) ;
+    free(cache);
+}
+
+
+bool ihtCacheHasFiller(IhtCache cache)
+{
+    return (bool) (cache->filler != NULL) ;
+}
+
+void ihtCacheSetBatchFiller(IhtCache cache, ihtCacheBatchFiller batch_filler)
+{
+    cache->batch_filler = batch_filler ;
+    if ( !batch_filler ) free_batch_fill(cache) ;
+}
+
+ihtCacheBatchFiller ihtCacheGetBatchFiller(IhtCache cache)
+{
+    return cache->batch_filler ;
+}
+
+int ihtCacheGetItemCount(IhtCache cache)
+{
+    int64_t item_count = ihtCacheGetItemCount64(cache) ;
+    return item_count > INT_MAX ? INT_MAX : (int) item_count ;
+}
+
+int64_t ihtCacheGetItemCount64(IhtCache cache)
+{
+    return cache->item_count + cache->old.count ;
+}
+
+int ihtCacheGetMaxItems(IhtCache cache)
+{
+    return cache->max_items > INT_MAX ? INT_MAX : (int) cache->max_items ;
+}
+
+int64_t ihtCacheGetMaxItems64(IhtCache cache)
+{
+    return cache->max_items ;
+}
+
+int ihtCacheGetKeySize(IhtCache cache)
+{
+    return cache->key_size ;
+}
+int ihtCacheGetValueSize(IhtCache cache)
+{
+    return cache->value_size ;
+}
+double ihtCacheGetMaxLoadFactor(IhtCache cache)
+{
+    return cache->max_load_factor ;
+}
+void ihtCacheSetMaxLoadFactor(IhtCache cache, double max_load_factor)
+{
+    cache->max_load_factor = max_load_factor ;
+}
+void ihtCacheSetMinCapacity(IhtCache cache, int min_capacity)
+{
+    cache->min_capacity = min_capacity ;
+}
+void ihtCacheSetMinCapacity64(IhtCache cache, int64_t min_capacity)
+{
+    cache->min_capacity = min_capacity ;
+}
+void ihtCacheSetWideIndex(IhtCache cache, bool wide)
+{
+    cache->wide_request = wide ;
+}
+bool ihtCacheGetWideIndex(IhtCache cache)
+{
+    return cache->wide_index ;
+}
+void ihtCacheSetCxtDestroyer(IhtCache cache, ihtCacheCxtDestroyer cxt_destroyer)
+{
+    cache->cxt_destroyer = cxt_destroyer ;
+}
+void ihtCacheSetValueDestroyer(IhtCache cache, ihtCacheValueDestroyer value_destroyer)
+{
+    cache->value_destroyer = value_destroyer ;
+}
+void ihtCacheSetNAValue(IhtCache cache, const void *na_value)
+{
+    if ( na_value ) {
+        memcpy(cache->na_value, na_value, cache->value_size) ;
+    } else {
+        bzero(cache->na_value, cache->value_size) ;
+    }
+}
+void ihtCacheSetProbeMode(IhtCache cache, IhtProbeMode probe_mode)
+{
+    cache->probe_mode = probe_mode ;
+}
+IhtProbeMode ihtCacheGetProbeMode(IhtCache cache)
+{
+    return cache->probe_mode ;
+}
+void ihtCacheSetLayout(IhtCache cache, IhtLayout layout)
+{
+    cache->layout = layout ;
+}
+IhtLayout ihtCacheGetLayout(IhtCache cache)
+{
+    return cache->layout ;
+}
+void ihtCacheSetAdmission(IhtCache cache, IhtAdmission admission)
+{
+    cache->admission_request = admission ;
+}
+IhtAdmission ihtCacheGetAdmission(IhtCache cache)
+{
+    return cache->admission_request ;
+}
+void ihtCacheSetAdaptiveBypass(IhtCache cache, bool enabled)
+{
+    cache->adaptive_bypass = enabled ;
+    cache->bypass.pass_period = BYPASS_PERIOD ;
+    start_bypass_phase(cache, BYPASS_MEASURE, BYPASS_WINDOW) ;
+    update_view(cache) ;
+}
+bool ihtCacheGetAdaptiveBypass(IhtCache cache)
+{
+    return cache->adaptive_bypass ;
+}
+void ihtCacheSetEvictionPolicy(IhtCache cache, IhtEvictionPolicy policy)
+{
+    cache->policy_request = policy ;
+}
+IhtEvictionPolicy ihtCacheGetEvictionPolicy(IhtCache cache)
+{
+    return cache->policy_request ;
+}
+void ihtCacheReconfigure(IhtCache cache)
+{
+    remove_all(cache);
+    deallocate(cache);
+    setup(cache);
+    allocate(cache);
+}
+
+void ihtCacheResize(IhtCache cache)
+{
+    // Complete a pending migration first
+    if ( cache->old.states ) migrate_step(cache, cache->old.max_entries) ;
+    release_bypass(cache) ;
+    cache->old = (struct iht_old_table) {
+        .states = cache->states,
+        .entries = cache->entries,
+        .items = cache->items,
+        .max_entries = cache->max_entries,
+        .entries_mask = cache->entries_mask,
+        .count = cache->item_count,
+        .epoch = cache->epoch,
+        .wide_index = cache->wide_index,
+        .entry_format = cache->entry_format,
+    } ;
+    // Migrated entries are added to the policy queues again
+    free_policy(cache) ;
+    free_sketch(cache) ;
+    setup(cache);
+    allocate(cache);
+}
+
+void ihtCacheClearStats(IhtCache cache)
+{
+    cache->stats = (struct iht_stats) {} ;
+    if ( cache->stripes ) bzero(cache->stripes, STATS_STRIPES * sizeof(*cache->stripes)) ;
+    cache->view.inline_hits = 0 ;
+}
+
+void ihtCacheSetStatsMode(IhtCache cache, IhtStatsMode mode, int sample_rate)
+{
+#if defined(IHT_NO_STATS)
+    (void) cache ; (void) mode ; (void) sample_rate ;
+#else
+    if ( mode == IHT_STATS_PER_THREAD && !cache->stripes ) {
+        cache->stripes = aligned_alloc(alignof(struct iht_stats_stripe), STATS_STRIPES * sizeof(*cache->stripes)) ;
+        bzero(cache->stripes, STATS_STRIPES * sizeof(*cache->stripes)) ;
+    }
+    cache->stats_mode = mode ;
+    cache->stats_sample = sample_rate > 1 ? sample_rate : 1 ;
+    cache->sample_tick = 0 ;
+    update_view(cache) ;
+#endif
+}
+
+IhtStatsMode ihtCacheGetStatsMode(IhtCache cache)
+{
+#if defined(IHT_NO_STATS)
+    (void) cache ;
+    return IHT_STATS_NONE ;
+#else
+    return cache->stats_mode ;
+#endif
+}
+
+static void add_stripes(struct iht_stats *total, const struct iht_stats_stripe *stripes)
+{
+    // All fields are int64_t counters
+    const size_t n_fields = sizeof(struct iht_stats) / sizeof(int64_t) ;
+    int64_t *sum = (int64_t *) total ;
+    for (int stripe = 0 ; stripe < STATS_STRIPES ; stripe++) {
+        const int64_t *counters = (const int64_t *) &stripes[stripe].stats ;
+        for (size_t i = 0 ; i < n_fields ; i++) sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED) ;
+    }
+}
+
+void ihtCacheGetStats(IhtCache cache, struct IhtCacheStats *out)
+{
+    struct iht_stats total = cache->stats ;
+    if ( cache->stripes ) add_stripes(&total, cache->stripes) ;
+    // Hits of the header inline path are counted separately, at the home slot
+    total.counters[STAT_HITS].count += cache->view.inline_hits ;
+    total.counters[STAT_HITS].probe_hist[0] += cache->view.inline_hits ;
+    *out = (struct IhtCacheStats) {
+        .mode = ihtCacheGetStatsMode(cache),
+        .policy = cache->policy,
+        .lookups = total.counters[STAT_HITS].count + total.counters[STAT_MISSES].count,
+        .hits = total.counters[STAT_HITS],
+        .misses = total.counters[STAT_MISSES],
+        .adds = total.counters[STAT_ADDS],
+        .updates = total.counters[STAT_UPDATES],
+        .evictions = total.counters[STAT_EVICTIONS],
+        .removes = total.counters[STAT_REMOVES],
+        .rejects = total.counters[STAT_REJECTS].count,
+        .fill_cycles = total.fill_cycles,
+        .passes = total.counters[STAT_PASSES].count,
+        .passing = cache->adaptive_bypass && cache->bypass.phase == BYPASS_PASS,
+        .inline_hits = cache->view.inline_hits,
+    } ;
+    memcpy(out->victim_ages, total.victim_ages, sizeof(out->victim_ages)) ;
+}
+
+// Basic get, put, and lookup functions
+
+bool ihtCacheFetch(IhtCache cache, const void *key, void *value_out)
+{
+    IhtIndex item_index = get_item(cache, key, key_hash(cache, key), KEY_GENERIC) ;
+    if ( item_index < 0 ) return false ;
+    copy_value(cache, value_out, item_value(cache, item_index)) ;
+    return true ;
+}
+
+bool ihtCachePut(IhtCache cache, const void *key, const void *value)
+{
+    IhtIndex item_index = alloc_new_item(cache, key) ;
+    if ( item_index < 0 ) return false ;
+    store_item(cache, item_index, key, value) ;
+    return true ;
+}   
+
+bool ihtCacheRemove(IhtCache cache, const void *key)
+{
+    struct iht_probe probe = { .hash = key_hash(cache, key) } ;
+    IhtIndex index = probe_slot(cache, key, &probe, KEY_GENERIC) ;
+    if ( index < 0 ) {
+        if ( LIKELY(cache->old.states == NULL) || !old_remove(cache, key, probe.hash) ) return false ;
+    } else {
+        remove_slot(cache, index) ;
+    }
+    count_stat(cache, STAT_REMOVES, probe.scans) ;
+    return true ;
+}
+
+bool ihtCacheLookup(IhtCache cache, const void *key, void *value_out)
+{
+    struct iht_probe probe ;
+    IhtIndex item_index = lookup_item(cache, key, &probe);
+    if ( item_index < 0 ) return false ;
+    copy_value(cache, value_out, item_value(cache, item_index)) ;
+    return true ;
+}
+
+void *ihtCacheGet(IhtCache cache, const void *key)
+{
+    IhtIndex item_index = get_item(cache, key, key_hash(cache, key), KEY_GENERIC) ;
+    if ( item_index < 0 ) return NULL ;
+    return item_value(cache, item_index) ;
+}
+
+IhtCacheFastValue ihtCacheGet_Fast(IhtCache cache, IhtCacheFastKey key)
+{
+    IhtIndex item_index = get_item(cache, &key, fast_hash(cache, key), KEY_FAST) ;
+    if ( UNLIKELY(item_index < 0) ) return *(IhtCacheFastValue *) cache->na_value ;
+    return cache->items[item_index].value ;
+}
+
+IhtCacheWideValue ihtCacheGet_Wide(IhtCache cache, IhtCacheWideKey key)
+{
+    IhtIndex item_index = get_item(cache, &key, wide_hash(cache, &key), KEY_WIDE) ;
+    if ( UNLIKELY(item_index < 0) ) return *(IhtCacheWideValue *) cache->na_value ;
+    return wide_items(cache)[item_index].value ;
+}
+
+int ihtCacheGetBatch(IhtCache cache, int n, const void *keys, void *values_out, uint64_t *miss_mask)
+{
+    IhtHash hashes[BATCH_STAGE] ;
+    int n_missing = 0 ;
+    if ( miss_mask ) bzero(miss_mask, sizeof(*miss_mask) * mask_words(n)) ;
+    if ( cache->batch_filler ) reserve_batch_fill(cache, n) ;
+
+    for (int start = 0 ; start < n ; start += BATCH_STAGE) {
+        int count = n - start < BATCH_STAGE ? n - start : BATCH_STAGE ;
+        const char *stage_keys = (const char *) keys + (ptrdiff_t) start * cache->key_size ;
+        char *stage_values = (char *) values_out + (ptrdiff_t) start * cache->value_size ;
+
+        for (int i = 0 ; i < count ; i++) {
+            hashes[i] = key_hash(cache, stage_keys + (ptrdiff_t) i * cache->key_size) ;
+            prefetch_slot(cache, hashes[i]) ;
+        }
+        for (int i = 0 ; i < count ; i++) prefetch_item(cache, hashes[i]) ;
+
+        for (int i = 0 ; i < count ; i++) {
+            const char *key = stage_keys + (ptrdiff_t) i * cache->key_size ;
+            char *value_out = stage_values + (ptrdiff_t) i * cache->value_size ;
+            IhtIndex item_index = batch_get_item(cache, key, hashes[i], KEY_GENERIC, start + i) ;
+            if ( item_index < 0 ) {
+                copy_value(cache, value_out, cache->na_value) ;
+                set_miss(miss_mask, start + i) ;
+                n_missing++ ;
+                continue ;
+            }
+            copy_value(cache, value_out, item_value(cache, item_index)) ;
+        }
     }
+    if ( cache->batch_filler ) n_missing -= fill_batch(cache, KEY_GENERIC, keys, values_out, miss_mask) ;
+    return n_missing ;
+}
 
-    IhtCache cache = calloc(1, sizeof(*cache));
-    cache->min_capacity = min_capacity;
-    cache->key_size = key_size;
-    cache->value_size = value_sz;
-    cache->max_load_factor = DEFAULT_LOAD_FACTOR;
-    cache->filler = filler;
-    cache->cxt = cxt;
+int ihtCacheGetBatch_Fast(IhtCache cache, int n, const IhtCacheFastKey *keys, IhtCacheFastValue *values_out, uint64_t *miss_mask)
+{
+    IhtHash hashes[BATCH_STAGE] ;
+    int n_missing = 0 ;
+    if ( miss_mask ) bzero(miss_mask, sizeof(*miss_mask) * mask_words(n)) ;
+    if ( cache->batch_filler ) reserve_batch_fill(cache, n) ;
 
-    setup(cache);
-    allocate(cache);
+    for (int start = 0 ; start < n ; start += BATCH_STAGE) {
+        int count = n - start < BATCH_STAGE ? n - start : BATCH_STAGE ;
 
-    return cache;
+        for (int i = 0 ; i < count ; i++) {
+            hashes[i] = fast_hash(cache, keys[start+i]) ;
+            prefetch_slot(cache, hashes[i]) ;
+        }
+        for (int i = 0 ; i < count ; i++) prefetch_item(cache, hashes[i]) ;
+
+        for (int i = 0 ; i < count ; i++) {
+            IhtIndex item_index = batch_get_item(cache, &keys[start+i], hashes[i], KEY_FAST, start + i) ;
+            if ( UNLIKELY(item_index < 0) ) {
+                values_out[start+i] = *(IhtCacheFastValue *) cache->na_value ;
+                set_miss(miss_mask, start + i) ;
+                n_missing++ ;
+                continue ;
+            }
+            values_out[start+i] = cache->items[item_index].value ;
+        }
+    }
+    if ( cache->batch_filler ) n_missing -= fill_batch(cache, KEY_FAST, keys, values_out, miss_mask) ;
+    return n_missing ;
 }
 
-void ihtCacheRemoveAll(IhtCache cache)
+static const char *stats_mode_name(IhtStatsMode mode)
 {
-    remove_all(cache);
+    switch ( mode ) {
+        case IHT_STATS_FULL: return "full" ;
+        case IHT_STATS_SAMPLED: return "sampled" ;
+        case IHT_STATS_PER_THREAD: return "per thread" ;
+        default: return "none" ;
+    }
 }
 
-void ihtCacheDestroy(IhtCache cache) 
+static const char *policy_name(IhtEvictionPolicy policy)
 {
-    remove_all(cache);
-    deallocate(cache);
-    if ( cache->cxt_destroyer ) {
-        cache->cxt_destroyer(cache->cxt);
+    switch ( policy ) {
+        case IHT_EVICT_SIEVE: return "sieve" ;
+        case IHT_EVICT_S3FIFO: return "s3-fifo" ;
+        case IHT_EVICT_SAMPLED_LRU: return "sampled lru" ;
+        case IHT_EVICT_GREEDY_DUAL: return "greedy dual" ;
+        default: return "clock" ;
     }
-    free(cache->na_value);
-    free(cache);
 }
 
+static void print_counter(FILE *fp, const char *label, IhtCounter counter, int indent)
+{
+    double ratio = counter.count>0 ? (double) counter.scans/counter.count : -1 ;
+    (void) fprintf(fp, "%*s%s: %" PRId64 " (scans=%" PRId64 ", ratio=%.2f)\n", indent*2, "", label, counter.count, counter.scans, ratio) ;
+}
 
-bool ihtCacheHasFiller(IhtCache cache)
+// Non empty buckets, as lower bound of the probe length:count
+static void print_histogram(FILE *fp, const char *label, const int64_t *hist, int n, bool log2_buckets, int indent)
 {
-    return (bool) (cache->filler != NULL) ;
+    (void) fprintf(fp, "%*s%s:", indent*2 + 2, "", label) ;
+    for (int b = 0 ; b < n ; b++) {
+        if ( !hist[b] ) continue ;
+        int64_t low = log2_buckets && b > 0 ? (int64_t) 1 << (b-1) : b ;
+        (void) fprintf(fp, " %" PRId64 ":%" PRId64, low, hist[b]) ;
+    }
+    (void) fprintf(fp, "\n") ;
 }
 
-int ihtCacheGetItemCount(IhtCache cache)
+static void print_stats(FILE *fp, const struct IhtCacheStats *stats, const char *label, int indent, int show_stats) ;
+
+void ihtCachePrintStats(FILE *fp, IhtCache cache, const char *label)
 {
-    return cache->item_count ;
+    return ihtCachePrintStats1(fp, cache, label, true, 2) ;
 }
 
-int ihtCacheGetMaxItems(IhtCache cache)
+
+void ihtCachePrintStats1(FILE *fp, IhtCache cache, const char *label, int indent, int show_stats)
 {
-    return cache->max_items ;
+    struct IhtCacheStats stats ;
+    ihtCacheGetStats(cache, &stats) ;
+    print_stats(fp, &stats, label, indent, show_stats) ;
 }
 
-int ihtCacheGetKeySize(IhtCache cache)
+static void print_stats(FILE *fp, const struct IhtCacheStats *stats_in, const char *label, int indent, int show_stats)
 {
-    return cache->key_size ;
+    struct IhtCacheStats stats = *stats_in ;
+    int64_t lookups = stats.lookups ;
+    (void) fprintf(fp, "%*s%s: Cache Stats: lookups: %" PRId64 " hit=%.2f miss=%.2f\n", indent, "", label,
+        lookups,
+        (100.0 * stats.hits.count) / (lookups + !lookups),
+        (100.0 * stats.misses.count) / (lookups + !lookups));
+    if  (show_stats>=2) {
+        if ( stats.mode != IHT_STATS_FULL ) (void) fprintf(fp, "%*sstats mode: %s\n", indent*2, "", stats_mode_name(stats.mode)) ;
+        if ( stats.policy != IHT_EVICT_CLOCK ) (void) fprintf(fp, "%*seviction policy: %s\n", indent*2, "", policy_name(stats.policy)) ;
+        print_counter(fp, "hits", stats.hits, indent);
+        if ( stats.inline_hits ) (void) fprintf(fp, "%*sinline hits: %" PRId64 "\n", indent*2, "", stats.inline_hits) ;
+        print_counter(fp, "misses", stats.misses, indent);
+        print_counter(fp, "adds", stats.adds, indent);
+        print_counter(fp, "updates", stats.updates, indent);
+        print_counter(fp, "evictions", stats.evictions, indent);
+        print_counter(fp, "removes", stats.removes, indent);
+        if ( stats.rejects ) (void) fprintf(fp, "%*srejects: %" PRId64 "\n", indent*2, "", stats.rejects) ;
+        if ( stats.fill_cycles ) (void) fprintf(fp, "%*sfill cycles: %" PRId64 "\n", indent*2, "", stats.fill_cycles) ;
+        if ( stats.passes || stats.passing ) {
+            (void) fprintf(fp, "%*spasses: %" PRId64 "%s\n", indent*2, "", stats.passes, stats.passing ? " (passing)" : "") ;
+        }
+        if ( stats.shared_fills ) (void) fprintf(fp, "%*sshared fills: %" PRId64 "\n", indent*2, "", stats.shared_fills) ;
+    }
+    if  (show_stats>=3) {
+        print_histogram(fp, "hit probes", stats.hits.probe_hist, IHT_PROBE_BUCKETS, true, indent) ;
+        print_histogram(fp, "miss probes", stats.misses.probe_hist, IHT_PROBE_BUCKETS, true, indent) ;
+        print_histogram(fp, "add probes", stats.adds.probe_hist, IHT_PROBE_BUCKETS, true, indent) ;
+        print_histogram(fp, "update probes", stats.updates.probe_hist, IHT_PROBE_BUCKETS, true, indent) ;
+        print_histogram(fp, "eviction scans", stats.evictions.probe_hist, IHT_PROBE_BUCKETS, true, indent) ;
+        print_histogram(fp, "victim ages", stats.victim_ages, IHT_VICTIM_AGES, false, indent) ;
+    }
 }
-int ihtCacheGetValueSize(IhtCache cache)
+
+// Sleep while *word is value, until woken (or for no reason)
+static void futex_wait(uint32_t *word, uint32_t value) {
+    (void) syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0) ;
+}
+
+static void futex_wake(uint32_t *word, int waiters) {
+    (void) syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, waiters, NULL, NULL, 0) ;
+}
+
+// Sharded cache: independent caches, each guarded by a lock in its own cache line.
+// Keys are routed by the high bits of a remixed 64-bit key hash, which do not depend
+// on the slot index and tag bits the shards take from their own hashes.
+//
+// The shard lock is held while the filler runs, for as long as the filler takes:
+// threads spin for a short while, then sleep on a futex until the lock is released.
+//
+// Each shard is also a seqlock: the sequence is odd while the lock holder runs an
+// operation. Optimistic readers take no lock, and retry if the sequence changed.
+
+enum { SHARD_UNLOCKED, SHARD_LOCKED, SHARD_SLEEPERS } ;
+
+struct iht_shard {
+    alignas(64) uint32_t lock ;   // SHARD_SLEEPERS: locked, and threads may sleep on it
+    unsigned seq ;
+    IhtCache cache ;
+} ;
+
+struct iht_sharded_cache {
+    int n_shards ;
+    uint64_t shard_mask ;
+    bool optimistic_reads ;
+    struct iht_shard *shards ;  // [n_shards]
+} ;
+
+static void lock_shard(struct iht_shard *shard) {
+    uint32_t state = SHARD_UNLOCKED ;
+    for (int spins = 0 ; !__atomic_compare_exchange_n(&shard->lock, &state, SHARD_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ; spins++ ) {
+        if ( spins >= SHARD_SPINS ) {
+            // The lock holder may be running a slow filler, or waiting for this CPU.
+            // Taken as SHARD_SLEEPERS, since other threads may still be sleeping.
+            while ( __atomic_exchange_n(&shard->lock, SHARD_SLEEPERS, __ATOMIC_ACQUIRE) != SHARD_UNLOCKED ) {
+                futex_wait(&shard->lock, SHARD_SLEEPERS) ;
+            }
+            break ;
+        }
+        _mm_pause() ;
+        state = SHARD_UNLOCKED ;
+    }
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED) ;
+    __atomic_thread_fence(__ATOMIC_RELEASE) ;
+}
+
+static void unlock_shard(struct iht_shard *shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE) ;
+    if ( __atomic_exchange_n(&shard->lock, SHARD_UNLOCKED, __ATOMIC_RELEASE) == SHARD_SLEEPERS ) futex_wake(&shard->lock, 1) ;
+}
+
+// Lookup without the shard lock, for CLOCK shards that need no other update on a hit.
+// Data read while a writer is active may be inconsistent, but stays within the
+// tables (item indexes are stored whole), and is discarded if the sequence changed.
+// The CLOCK age is raised after the read is validated, with a relaxed compare and
+// swap that is lost if the slot changed meanwhile. Saturated ages are not written,
+// so hits on hot entries do not move cache lines between cores. Returns false if
+// the key is not found, or the read keeps conflicting with writers.
+static bool optimistic_read(struct iht_shard *shard, const void *key, KeyKind kind, void *value_out)
 {
-    return cache->value_size ;
+    IhtCache cache = shard->cache ;
+    if ( cache->policy != IHT_EVICT_CLOCK || cache->admission != IHT_ADMIT_ALL ||
+        cache->adaptive_bypass || cache->old.states != NULL ) return false ;
+    struct iht_probe probe = { .hash = key_hash(cache, key) } ;
+    // value_out is written only for a validated hit
+    alignas(max_align_t) char value_space[cache->value_size] ;
+    for (int tries = 0 ; tries < OPTIMISTIC_TRIES ; tries++) {
+        unsigned seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE) ;
+        if ( seq & 1 ) {
+            _mm_pause() ;
+            continue ;
+        }
+        IhtIndex index = probe_slot(cache, key, &probe, kind) ;
+        unsigned char state = 0 ;
+        if ( index >= 0 ) {
+            state = cache->states[index] ;
+            copy_value(cache, value_space, item_value(cache, slot_item(cache, index))) ;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+        if ( __atomic_load_n(&shard->seq, __ATOMIC_RELAXED) != seq ) continue ;
+        if ( index < 0 ) return false ;
+        copy_value(cache, value_out, value_space) ;
+
+        if ( slot_age(state) < SLOT_MAX_AGE ) {
+            (void) __atomic_compare_exchange_n(&cache->states[index], &state, (unsigned char) (state + 1),
+                false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ;
+        }
+        // Other modes write shared counters
+        if ( cache->stats_mode == IHT_STATS_PER_THREAD ) count_stat(cache, STAT_HITS, probe.scans) ;
+        return true ;
+    }
+    return false ;
 }
-double ihtCacheGetMaxLoadFactor(IhtCache cache)
+
+static struct iht_shard *key_shard(IhtShardedCache sharded, const void *key) {
+    // Hashing depends only on the key size, the same for all shards
+    IhtHash hash = key_hash_width(sharded->shards[0].cache, key, true) ;
+    return &sharded->shards[(mix64(hash) >> UINT32_WIDTH) & sharded->shard_mask] ;
+}
+
+static void add_counter(IhtCacheCounter *sum, const IhtCacheCounter *counter) {
+    sum->count += counter->count ;
+    sum->scans += counter->scans ;
+    for (int b = 0 ; b < IHT_PROBE_BUCKETS ; b++) sum->probe_hist[b] += counter->probe_hist[b] ;
+}
+
+static void add_stats(struct IhtCacheStats *sum, const struct IhtCacheStats *stats) {
+    sum->lookups += stats->lookups ;
+    add_counter(&sum->hits, &stats->hits) ;
+    add_counter(&sum->misses, &stats->misses) ;
+    add_counter(&sum->adds, &stats->adds) ;
+    add_counter(&sum->updates, &stats->updates) ;
+    add_counter(&sum->evictions, &stats->evictions) ;
+    add_counter(&sum->removes, &stats->removes) ;
+    sum->rejects += stats->rejects ;
+    sum->fill_cycles += stats->fill_cycles ;
+    sum->passes += stats->passes ;
+    sum->passing |= stats->passing ;
+    sum->shared_fills += stats->shared_fills ;
+    sum->inline_hits += stats->inline_hits ;
+    for (int age = 0 ; age < IHT_VICTIM_AGES ; age++) sum->victim_ages[age] += stats->victim_ages[age] ;
+}
+
+IhtShardedCache ihtShardedCacheCreate(int64_t min_capacity, int n_shards, int key_size, int value_size, ihtCacheFiller filler, void *cxt)
 {
-    return cache->max_load_factor ;
+    int shards = 1 ;
+    while ( shards < n_shards && shards < IHT_MAX_SHARDS ) shards *= 2 ;
+
+    IhtShardedCache sharded = calloc(1, sizeof(*sharded)) ;
+    sharded->n_shards = shards ;
+    sharded->shard_mask = (uint64_t) shards - 1 ;
+    sharded->shards = aligned_alloc(alignof(struct iht_shard), shards * sizeof(struct iht_shard)) ;
+    int64_t shard_capacity = (min_capacity + shards - 1) / shards ;
+    for (int i = 0 ; i < shards ; i++) {
+        sharded->shards[i] = (struct iht_shard) { .cache = ihtCacheCreate64(shard_capacity, key_size, value_size, filler, cxt) } ;
+    }
+    return sharded ;
 }
-void ihtCacheSetMaxLoadFactor(IhtCache cache, double max_load_factor)
+
+void ihtShardedCacheDestroy(IhtShardedCache cache)
 {
-    cache->max_load_factor = max_load_factor ;
+    for (int i = 0 ; i < cache->n_shards ; i++) ihtCacheDestroy(cache->shards[i].cache) ;
+    free(cache->shards) ;
+    free(cache) ;
 }
-void ihtCacheSetMinCapacity(IhtCache cache, int min_capacity)
+
+int ihtShardedCacheGetShardCount(IhtShardedCache cache)
 {
-    cache->min_capacity = min_capacity ;
+    return cache->n_shards ;
 }
-void ihtCacheSetCxtDestroyer(IhtCache cache, ihtCacheCxtDestroyer cxt_destroyer)
+
+IhtCache ihtShardedCacheGetShard(IhtShardedCache cache, int shard)
 {
-    cache->cxt_destroyer = cxt_destroyer ;
+    return cache->shards[shard].cache ;
 }
-void ihtCacheSetValueDestroyer(IhtCache cache, ihtCacheValueDestroyer value_destroyer)
+
+void ihtShardedCacheSetOptimisticReads(IhtShardedCache cache, bool enabled)
 {
-    cache->value_destroyer = value_destroyer ;
+    cache->optimistic_reads = enabled ;
+    if ( !enabled ) return ;
+    for (int i = 0 ; i < cache->n_shards ; i++) {
+        IhtCache shard = cache->shards[i].cache ;
+        if ( ihtCacheGetStatsMode(shard) != IHT_STATS_NONE ) ihtCacheSetStatsMode(shard, IHT_STATS_PER_THREAD, 1) ;
+    }
 }
-void ihtCacheSetNAValue(IhtCache cache, const void *na_value)
+
+bool ihtShardedCacheGetOptimisticReads(IhtShardedCache cache)
 {
-    if ( na_value ) {
-        memcpy(cache->na_value, na_value, cache->value_size) ;
-    } else {
-        bzero(cache->na_value, cache->value_size) ;
+    return cache->optimistic_reads ;
+}
+
+bool ihtShardedCacheFetch(IhtShardedCache cache, const void *key, void *value_out)
+{
+    struct iht_shard *shard = key_shard(cache, key) ;
+    if ( cache->optimistic_reads && optimistic_read(shard, key, KEY_GENERIC, value_out) ) return true ;
+    lock_shard(shard) ;
+    bool found = ihtCacheFetch(shard->cache, key, value_out) ;
+    unlock_shard(shard) ;
+    return found ;
+}
+
+IhtCacheFastValue ihtShardedCacheGet_Fast(IhtShardedCache cache, IhtCacheFastKey key)
+{
+    struct iht_shard *shard = key_shard(cache, &key) ;
+    IhtCacheFastValue value = { 0 } ;
+    if ( cache->optimistic_reads && optimistic_read(shard, &key, KEY_FAST, &value) ) return value ;
+    lock_shard(shard) ;
+    value = ihtCacheGet_Fast(shard->cache, key) ;
+    unlock_shard(shard) ;
+    return value ;
+}
+
+bool ihtShardedCacheLookup(IhtShardedCache cache, const void *key, void *value_out)
+{
+    struct iht_shard *shard = key_shard(cache, key) ;
+    if ( cache->optimistic_reads && optimistic_read(shard, key, KEY_GENERIC, value_out) ) return true ;
+    lock_shard(shard) ;
+    bool found = ihtCacheLookup(shard->cache, key, value_out) ;
+    unlock_shard(shard) ;
+    return found ;
+}
+
+bool ihtShardedCachePut(IhtShardedCache cache, const void *key, const void *value)
+{
+    struct iht_shard *shard = key_shard(cache, key) ;
+    lock_shard(shard) ;
+    bool stored = ihtCachePut(shard->cache, key, value) ;
+    unlock_shard(shard) ;
+    return stored ;
+}
+
+bool ihtShardedCacheRemove(IhtShardedCache cache, const void *key)
+{
+    struct iht_shard *shard = key_shard(cache, key) ;
+    lock_shard(shard) ;
+    bool removed = ihtCacheRemove(shard->cache, key) ;
+    unlock_shard(shard) ;
+    return removed ;
+}
+
+void ihtShardedCacheRemoveAll(IhtShardedCache cache)
+{
+    for (int i = 0 ; i < cache->n_shards ; i++) {
+        struct iht_shard *shard = &cache->shards[i] ;
+        lock_shard(shard) ;
+        ihtCacheRemoveAll(shard->cache) ;
+        unlock_shard(shard) ;
     }
 }
-void ihtCacheReconfigure(IhtCache cache)
+
+int64_t ihtShardedCacheGetItemCount(IhtShardedCache cache)
 {
-    remove_all(cache);
-    deallocate(cache);
-    setup(cache);
-    allocate(cache);
+    int64_t count = 0 ;
+    for (int i = 0 ; i < cache->n_shards ; i++) {
+        struct iht_shard *shard = &cache->shards[i] ;
+        lock_shard(shard) ;
+        count += ihtCacheGetItemCount64(shard->cache) ;
+        unlock_shard(shard) ;
+    }
+    return count ;
 }
 
-void ihtCacheClearStats(IhtCache cache)
+void ihtShardedCacheGetStats(IhtShardedCache cache, struct IhtCacheStats *out)
 {
-    cache->stats = (struct iht_stats) {} ;
+    for (int i = 0 ; i < cache->n_shards ; i++) {
+        struct iht_shard *shard = &cache->shards[i] ;
+        struct IhtCacheStats stats ;
+        lock_shard(shard) ;
+        ihtCacheGetStats(shard->cache, &stats) ;
+        unlock_shard(shard) ;
+        if ( i == 0 ) *out = stats ; else add_stats(out, &stats) ;
+    }
 }
 
-// Basic get, put, and lookup functions
+void ihtShardedCachePrintStats(FILE *fp, IhtShardedCache cache, const char *label, int indent, int show_stats)
+{
+    struct IhtCacheStats stats ;
+    ihtShardedCacheGetStats(cache, &stats) ;
+    print_stats(fp, &stats, label, indent, show_stats) ;
+}
 
-bool ihtCacheFetch(IhtCache cache, const void *key, void *value_out)
+// Atomic cache (IhtAtomicCache): a lock-free table of fast keys and values. Slots are
+// grouped in buckets of ATOMIC_BUCKET_SLOTS, and a key lives in the bucket of its hash.
+// Each slot has a 64-bit control word: state, removal mark, number of updaters in
+// progress, version, and the high 32 bits of the hash. Slots change hands with a
+// compare and swap of the control word, and the version changes whenever the slot
+// gets a new key: a reader that sees the same version before and after reading the
+// key knows the key belonged to the slot meanwhile. Values are read and written with
+// single 16-byte atomic accesses (cmpxchg16b, or aligned AVX loads and stores), so
+// updates in place are atomic for readers.
+//
+// Concurrent puts of a missing key may each publish a copy. The first readable copy
+// in bucket order is the one found by lookups and updates, and the putters remove
+// the other copies after publishing.
+//
+// Fetches fill a missing key once (single flight): the fetch that misses publishes the
+// key in a filling slot before calling the filler, and fetches of the same key wait
+// for the fill to end, spinning a while and then sleeping on the control word (futex).
+// A filled value is published with the version of the filling slot, and a failed fill
+// leaves the slot empty with that version, so waiters know whether the fill they saw
+// succeeded. Of the filling slots published concurrently for a key, one is filled.
+
+#define ATOMIC_EMPTY 0x0ULL
+#define ATOMIC_BUSY 0x1ULL              // claimed for a new key, not readable
+#define ATOMIC_READY 0x2ULL
+#define ATOMIC_FILLING 0x3ULL           // key readable, value being filled by a fetch
+#define ATOMIC_STATE_MASK 0x3ULL
+#define ATOMIC_REMOVED 0x4ULL           // removed, freed by the last updater
+#define ATOMIC_WAITING 0x4ULL           // on a filling slot: fetches sleep until the fill ends
+#define ATOMIC_UPDATER 0x8ULL
+#define ATOMIC_UPDATERS_MASK 0x7F8ULL
+#define ATOMIC_VERSION 0x800ULL
+#define ATOMIC_VERSION_MASK 0xFFFFF800ULL
+#define ATOMIC_TAG_SHIFT 32
+
+// The base ISA level does not include cmpxchg16b
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define IHT_CX16
+#else
+#define IHT_CX16 __attribute__((target("cx16")))
+#endif
+
+typedef unsigned __int128 IhtUint128 ;
+
+struct iht_atomic_pair {
+    IhtCacheFastKey key ;
+    alignas(16) IhtCacheFastValue value ;
+} ;
+
+struct iht_atomic_cache {
+    uint64_t *ctrl ;                    // [n_slots] control words
+    struct iht_atomic_pair *pairs ;     // [n_slots]
+    unsigned char *refs ;               // [n_slots] referenced since the eviction hand passed
+    int64_t n_slots ;
+    uint64_t bucket_mask ;
+    ihtCacheFiller filler ;
+    void *cxt ;
+    struct iht_stats_stripe *stripes ;  // [STATS_STRIPES]
+} ;
+
+static inline IHT_CX16 IhtCacheFastValue load_value16(IhtCacheFastValue *src) {
+    IhtCacheFastValue value ;
+#if defined(__AVX__)
+    // Aligned 16-byte loads are atomic on processors with AVX
+    _mm_storeu_si128((__m128i *) &value, _mm_load_si128((const __m128i *) src)) ;
+#else
+    IhtUint128 v = __sync_val_compare_and_swap((IhtUint128 *) src, 0, 0) ;
+    memcpy(&value, &v, sizeof(value)) ;
+#endif
+    return value ;
+}
+
+static inline IHT_CX16 void store_value16(IhtCacheFastValue *dst, IhtCacheFastValue value) {
+#if defined(__AVX__)
+    _mm_store_si128((__m128i *) dst, _mm_loadu_si128((const __m128i *) &value)) ;
+#else
+    IhtUint128 desired, expected = 0 ;
+    memcpy(&desired, &value, sizeof(desired)) ;
+    for (;;) {
+        IhtUint128 seen = __sync_val_compare_and_swap((IhtUint128 *) dst, expected, desired) ;
+        if ( seen == expected ) return ;
+        expected = seen ;
+    }
+#endif
+}
+
+static inline void count_atomic(IhtAtomicCache cache, StatKind kind, IhtIndex scans)
+{
+#if defined(IHT_NO_STATS)
+    (void) cache ; (void) kind ; (void) scans ;
+#else
+    IhtCounter *c = &cache->stripes[stats_stripe()].stats.counters[kind] ;
+    add_relaxed(&c->count, 1) ;
+    add_relaxed(&c->scans, scans) ;
+    add_relaxed(&c->probe_hist[probe_bucket(scans)], 1) ;
+#endif
+}
+
+static inline uint64_t atomic_readable_bits(uint64_t ctrl) {
+    return ctrl & (ATOMIC_STATE_MASK | ATOMIC_REMOVED) ;
+}
+
+// Control word of a slot getting a new key (or freed, with tag_bits 0)
+static inline uint64_t atomic_new_key(uint64_t ctrl, uint64_t tag_bits, uint64_t state) {
+    return ((ctrl + ATOMIC_VERSION) & ATOMIC_VERSION_MASK) | tag_bits | state ;
+}
+
+static inline IhtIndex atomic_bucket(IhtAtomicCache cache, uint64_t hash) {
+    return (IhtIndex) (hash & cache->bucket_mask) * ATOMIC_BUCKET_SLOTS ;
+}
+
+static inline bool atomic_findable(uint64_t ctrl, bool filling) {
+    return atomic_readable_bits(ctrl) == ATOMIC_READY || (filling && (ctrl & ATOMIC_STATE_MASK) == ATOMIC_FILLING) ;
+}
+
+// First readable slot holding key in its bucket, from position start, with the control
+// word seen and (if value_out) the value. Slots being filled are found too if filling,
+// and their value is not valid. -1 if not found.
+static IhtIndex atomic_find(IhtAtomicCache cache, IhtCacheFastKey key, uint64_t hash, int start, bool filling,
+    uint64_t *ctrl_out, IhtCacheFastValue *value_out)
 {
-    IhtEntry e = lookup_entry(cache, key);
-    if ( !e ) {
-        e = calc_new_entry(cache, key) ;
-        if ( !e ) return false ;
+    IhtIndex bucket = atomic_bucket(cache, hash) ;
+    uint64_t tag_bits = hash >> ATOMIC_TAG_SHIFT << ATOMIC_TAG_SHIFT ;
+    for (int i = start ; i < ATOMIC_BUCKET_SLOTS ; i++) {
+        IhtIndex slot = bucket + i ;
+        uint64_t ctrl = __atomic_load_n(&cache->ctrl[slot], __ATOMIC_ACQUIRE) ;
+        for (;;) {
+            if ( !atomic_findable(ctrl, filling) || (ctrl & ~(uint64_t) UINT32_MAX) != tag_bits ) break ;
+            struct iht_atomic_pair *pair = &cache->pairs[slot] ;
+            IhtCacheFastKey seen = {
+                __atomic_load_n(&pair->key.v0, __ATOMIC_RELAXED),
+                __atomic_load_n(&pair->key.v1, __ATOMIC_RELAXED),
+            } ;
+            IhtCacheFastValue value = { 0 } ;
+            if ( value_out ) value = load_value16(&pair->value) ;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+            uint64_t again = __atomic_load_n(&cache->ctrl[slot], __ATOMIC_ACQUIRE) ;
+            const uint64_t same_key = ATOMIC_VERSION_MASK | ATOMIC_STATE_MASK ;
+            if ( (again & same_key) != (ctrl & same_key) ) {
+                ctrl = again ;          // the slot got a new key meanwhile
+                continue ;
+            }
+            if ( !fast_key_equals(seen, key) ) break ;
+            *ctrl_out = ctrl ;
+            if ( value_out ) *value_out = value ;
+            return slot ;
+        }
     }
-    memcpy(value_out, item_value(cache, e->item_index), cache->value_size) ;
-    return true ;
+    return -1 ;
 }
 
-bool ihtCachePut(IhtCache cache, const void *key, const void *value)
+// Remove the key found at slot with ctrl: free the slot, or mark it removed if updaters
+// are in progress. False if the slot no longer holds the key.
+static bool atomic_remove_slot(IhtAtomicCache cache, IhtIndex slot, uint64_t ctrl)
 {
-    IhtEntry e = alloc_new_entry(cache, key) ;
-    if ( !e ) return false ;
-    store_item(cache, e->item_index, key, value) ;
-    return true ;
-}   
+    uint64_t version = ctrl & ATOMIC_VERSION_MASK ;
+    for (;;) {
+        if ( (ctrl & ATOMIC_VERSION_MASK) != version || atomic_readable_bits(ctrl) != ATOMIC_READY ) return false ;
+        uint64_t next = (ctrl & ATOMIC_UPDATERS_MASK) ? ctrl | ATOMIC_REMOVED : atomic_new_key(ctrl, 0, ATOMIC_EMPTY) ;
+        if ( __atomic_compare_exchange_n(&cache->ctrl[slot], &ctrl, next, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED) ) return true ;
+    }
+}
 
-bool ihtCacheLookup(IhtCache cache, const void *key, void *value_out)
+// Update the value in place. Updaters register in the control word: the slot can not
+// get a new key while updaters are in progress, and the last updater out frees a slot
+// removed meanwhile. False if the slot no longer holds the key.
+static bool atomic_update(IhtAtomicCache cache, IhtIndex slot, uint64_t ctrl, IhtCacheFastValue value)
 {
-    IhtEntry e = lookup_entry(cache, key);
-    if ( !e ) return false ;
-    memcpy(value_out, item_value(cache, e->item_index), cache->value_size) ;
-    return true ;
+    uint64_t *word = &cache->ctrl[slot] ;
+    uint64_t version = ctrl & ATOMIC_VERSION_MASK ;
+    for (;;) {
+        if ( (ctrl & ATOMIC_VERSION_MASK) != version || atomic_readable_bits(ctrl) != ATOMIC_READY ) return false ;
+        if ( UNLIKELY((ctrl & ATOMIC_UPDATERS_MASK) == ATOMIC_UPDATERS_MASK) ) {
+            _mm_pause() ;
+            ctrl = __atomic_load_n(word, __ATOMIC_RELAXED) ;
+            continue ;
+        }
+        if ( __atomic_compare_exchange_n(word, &ctrl, ctrl + ATOMIC_UPDATER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) break ;
+    }
+    store_value16(&cache->pairs[slot].value, value) ;
+    ctrl = __atomic_load_n(word, __ATOMIC_RELAXED) ;
+    for (;;) {
+        uint64_t next = ctrl - ATOMIC_UPDATER ;
+        if ( (next & (ATOMIC_UPDATERS_MASK | ATOMIC_REMOVED)) == ATOMIC_REMOVED ) next = atomic_new_key(next, 0, ATOMIC_EMPTY) ;
+        if ( __atomic_compare_exchange_n(word, &ctrl, next, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED) ) return true ;
+    }
 }
 
-void *ihtCacheGet(IhtCache cache, const void *key)
+// Claim a slot of the bucket for a new key: an empty slot, or else a victim not
+// referenced since the hand last passed (second chance). Slots with updaters in
+// progress are skipped. -1 if every slot of the bucket is in use by other threads.
+static IhtIndex atomic_claim(IhtAtomicCache cache, uint64_t hash, bool *evicted)
+{
+    IhtIndex bucket = atomic_bucket(cache, hash) ;
+    uint64_t tag_bits = hash >> ATOMIC_TAG_SHIFT << ATOMIC_TAG_SHIFT ;
+    for (int i = 0 ; i < ATOMIC_BUCKET_SLOTS ; i++) {
+        uint64_t *word = &cache->ctrl[bucket + i] ;
+        uint64_t ctrl = __atomic_load_n(word, __ATOMIC_RELAXED) ;
+        while ( (ctrl & ATOMIC_STATE_MASK) == ATOMIC_EMPTY ) {
+            uint64_t next = atomic_new_key(ctrl, tag_bits, ATOMIC_BUSY) ;
+            if ( __atomic_compare_exchange_n(word, &ctrl, next, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) return bucket + i ;
+        }
+    }
+    // The hand starts at a position taken from the hash, below the bucket bits
+    int hand = (int) (hash >> (ATOMIC_TAG_SHIFT - 3)) ;
+    for (int i = 0 ; i < 2*ATOMIC_BUCKET_SLOTS ; i++) {
+        IhtIndex slot = bucket + ((hand + i) & (ATOMIC_BUCKET_SLOTS - 1)) ;
+        uint64_t *word = &cache->ctrl[slot] ;
+        uint64_t ctrl = __atomic_load_n(word, __ATOMIC_RELAXED) ;
+        if ( (ctrl & (ATOMIC_STATE_MASK | ATOMIC_REMOVED | ATOMIC_UPDATERS_MASK)) != ATOMIC_READY ) continue ;
+        if ( i < ATOMIC_BUCKET_SLOTS && __atomic_load_n(&cache->refs[slot], __ATOMIC_RELAXED) ) {
+            __atomic_store_n(&cache->refs[slot], 0, __ATOMIC_RELAXED) ;
+            continue ;
+        }
+        uint64_t next = atomic_new_key(ctrl, tag_bits, ATOMIC_BUSY) ;
+        if ( __atomic_compare_exchange_n(word, &ctrl, next, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+            *evicted = true ;
+            return slot ;
+        }
+    }
+    return -1 ;
+}
+
+// Remove the copies of key published by concurrent puts, keeping the first one
+static void atomic_dedup(IhtAtomicCache cache, IhtCacheFastKey key, uint64_t hash, IhtIndex mine, uint64_t mine_ctrl)
 {
-    IhtEntry e = lookup_entry(cache, key);
-    if ( !e ) {
-        e = calc_new_entry(cache, key) ;
-        if ( !e ) return NULL ;
+    uint64_t ctrl ;
+    IhtIndex first = atomic_find(cache, key, hash, 0, false, &ctrl, NULL) ;
+    IhtIndex bucket = atomic_bucket(cache, hash) ;
+    if ( first >= 0 && first < mine ) {
+        (void) atomic_remove_slot(cache, mine, mine_ctrl) ;
+        return ;
+    }
+    for (IhtIndex slot = mine ; slot >= 0 ; ) {
+        slot = atomic_find(cache, key, hash, (int) (slot + 1 - bucket), false, &ctrl, NULL) ;
+        if ( slot >= 0 ) (void) atomic_remove_slot(cache, slot, ctrl) ;
     }
-    return item_value(cache, e->item_index) ;
 }
 
-IhtCacheFastValue ihtCacheGet_Fast(IhtCache cache, IhtCacheFastKey key)
+// Key of a claimed slot, not yet published
+static inline void atomic_store_key(IhtAtomicCache cache, IhtIndex slot, IhtCacheFastKey key) {
+    __atomic_store_n(&cache->pairs[slot].key.v0, key.v0, __ATOMIC_RELAXED) ;
+    __atomic_store_n(&cache->pairs[slot].key.v1, key.v1, __ATOMIC_RELAXED) ;
+    __atomic_store_n(&cache->refs[slot], 0, __ATOMIC_RELAXED) ;
+}
+
+// Put: update the first copy of key in place, or publish a new copy. False if no slot
+// could be claimed.
+static bool atomic_put(IhtAtomicCache cache, IhtCacheFastKey key, uint64_t hash, IhtCacheFastValue value)
 {
-    IhtEntry e = fast_lookup_entry(cache, key) ;
-    if ( UNLIKELY(!e) ) {
-        e = calc_new_entry(cache, &key) ;
-        if ( UNLIKELY(!e) ) return *(IhtCacheFastValue *) cache->na_value ;
+    for (;;) {
+        uint64_t ctrl ;
+        IhtIndex slot = atomic_find(cache, key, hash, 0, false, &ctrl, NULL) ;
+        if ( slot >= 0 ) {
+            if ( atomic_update(cache, slot, ctrl, value) ) {
+                count_atomic(cache, STAT_UPDATES, slot - atomic_bucket(cache, hash)) ;
+                return true ;
+            }
+            continue ;                  // removed or evicted meanwhile
+        }
+        bool evicted = false ;
+        slot = atomic_claim(cache, hash, &evicted) ;
+        if ( slot < 0 ) return false ;
+        IhtIndex scans = slot - atomic_bucket(cache, hash) ;
+        if ( evicted ) count_atomic(cache, STAT_EVICTIONS, scans) ;
+        atomic_store_key(cache, slot, key) ;
+        store_value16(&cache->pairs[slot].value, value) ;
+        // Only the claiming thread changes a busy slot
+        ctrl = (__atomic_load_n(&cache->ctrl[slot], __ATOMIC_RELAXED) & ~ATOMIC_STATE_MASK) | ATOMIC_READY ;
+        __atomic_store_n(&cache->ctrl[slot], ctrl, __ATOMIC_RELEASE) ;
+        count_atomic(cache, STAT_ADDS, scans) ;
+        atomic_dedup(cache, key, hash, slot, ctrl) ;
+        return true ;
     }
-    return cache->items[e->item_index].value ;
 }
 
-static void print_counter(FILE *fp, const char *label, IhtCounter counter, int indent)
+// End the fill of a slot, with the next control word, and wake the waiting fetches.
+// Only the filling fetch changes the slot, other threads only set ATOMIC_WAITING.
+static void atomic_end_fill(IhtAtomicCache cache, IhtIndex slot, uint64_t next)
 {
-    double ratio = counter.count>0 ? (double) counter.scans/counter.count : -1 ;
-    (void) fprintf(fp, "%*s%s: %d (scans=%d, ratio=%.2f)\n", indent*2, "", label, counter.count, counter.scans, ratio) ;
+    uint64_t prev = __atomic_exchange_n(&cache->ctrl[slot], next, __ATOMIC_RELEASE) ;
+    if ( prev & ATOMIC_WAITING ) futex_wake((uint32_t *) &cache->ctrl[slot], INT_MAX) ;
 }
 
-void ihtCachePrintStats(FILE *fp, IhtCache cache, const char *label)
+typedef enum { FILL_DONE, FILL_FAILED, FILL_LOST } FillResult ;
+
+// Wait for the fill of the slot seen filling with ctrl, and get the value. FILL_LOST
+// if the slot got another key before the value could be read (or the fill was
+// abandoned): the fetch starts over.
+static FillResult atomic_wait_fill(IhtAtomicCache cache, IhtIndex slot, uint64_t ctrl, IhtCacheFastValue *value_out)
 {
-    return ihtCachePrintStats1(fp, cache, label, true, 2) ;
+    uint64_t *word = &cache->ctrl[slot] ;
+    const uint64_t same_fill = ATOMIC_VERSION_MASK | ATOMIC_STATE_MASK ;
+    const uint64_t filling = ctrl & same_fill ;
+    for (int spins = 0 ; (ctrl & same_fill) == filling ; ) {
+        if ( spins < FILL_SPINS ) {
+            spins++ ;
+            _mm_pause() ;
+        } else if ( (ctrl & ATOMIC_WAITING) ||
+            __atomic_compare_exchange_n(word, &ctrl, ctrl | ATOMIC_WAITING, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+            // The low half of the control word has the state and version (little endian)
+            futex_wait((uint32_t *) word, (uint32_t) (ctrl | ATOMIC_WAITING)) ;
+        }
+        ctrl = __atomic_load_n(word, __ATOMIC_ACQUIRE) ;
+    }
+    if ( (ctrl & ATOMIC_VERSION_MASK) != (filling & ATOMIC_VERSION_MASK) ) return FILL_LOST ;
+    if ( (ctrl & ATOMIC_STATE_MASK) == ATOMIC_EMPTY ) return FILL_FAILED ;
+    if ( atomic_readable_bits(ctrl) != ATOMIC_READY ) return FILL_LOST ;
+    IhtCacheFastValue value = load_value16(&cache->pairs[slot].value) ;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+    if ( (__atomic_load_n(word, __ATOMIC_RELAXED) & same_fill) != (ctrl & same_fill) ) return FILL_LOST ;
+    *value_out = value ;
+    return FILL_DONE ;
 }
 
+IhtAtomicCache ihtAtomicCacheCreate(int64_t min_capacity, ihtCacheFiller filler, void *cxt)
+{
+    int64_t n_buckets = 1 ;
+    while ( (double) n_buckets * ATOMIC_BUCKET_SLOTS * ATOMIC_LOAD_FACTOR < (double) min_capacity ) n_buckets *= 2 ;
+
+    IhtAtomicCache cache = calloc(1, sizeof(*cache)) ;
+    cache->n_slots = n_buckets * ATOMIC_BUCKET_SLOTS ;
+    cache->bucket_mask = (uint64_t) n_buckets - 1 ;
+    cache->filler = filler ;
+    cache->cxt = cxt ;
+    cache->ctrl = aligned_alloc(ATOMIC_BUCKET_SLOTS * sizeof(uint64_t), cache->n_slots * sizeof(uint64_t)) ;
+    bzero(cache->ctrl, cache->n_slots * sizeof(uint64_t)) ;
+    cache->pairs = aligned_alloc(alignof(struct iht_atomic_pair), cache->n_slots * sizeof(struct iht_atomic_pair)) ;
+    bzero(cache->pairs, cache->n_slots * sizeof(struct iht_atomic_pair)) ;
+    cache->refs = calloc(cache->n_slots, 1) ;
+    cache->stripes = aligned_alloc(alignof(struct iht_stats_stripe), STATS_STRIPES * sizeof(*cache->stripes)) ;
+    bzero(cache->stripes, STATS_STRIPES * sizeof(*cache->stripes)) ;
+    return cache ;
+}
 
-void ihtCachePrintStats1(FILE *fp, IhtCache cache, const char *label, int indent, int show_stats)
+void ihtAtomicCacheDestroy(IhtAtomicCache cache)
 {
-    struct iht_stats *stats = &cache->stats;
-    (void) fprintf(fp, "%*s%s: Cache Stats: lookups: %d hit=%.2f miss=%.2f\n", indent, "", label,
-        stats->lookups,
-        (100.0 * stats->hits.count) / (stats->lookups + !stats->lookups),
-        (100.0 * stats->misses.count) / (stats->lookups + !stats->lookups));
-    if  (show_stats>=2) {
-        print_counter(fp, "hits", stats->hits, indent);
-        print_counter(fp, "misses", stats->misses, indent);
-        print_counter(fp, "adds", stats->adds, indent);
-        print_counter(fp, "updates", stats->updates, indent);
-        print_counter(fp, "evictions", stats->evictions, indent);
+    free(cache->ctrl) ;
+    free(cache->pairs) ;
+    free(cache->refs) ;
+    free(cache->stripes) ;
+    free(cache) ;
+}
+
+bool ihtAtomicCacheLookup(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out)
+{
+    uint64_t hash = fast_key_hash_width(key, true) ;
+    uint64_t ctrl ;
+    IhtIndex slot = atomic_find(cache, key, hash, 0, false, &ctrl, value_out) ;
+    IhtIndex scans = slot >= 0 ? slot - atomic_bucket(cache, hash) : ATOMIC_BUCKET_SLOTS ;
+    if ( slot < 0 ) {
+        count_atomic(cache, STAT_MISSES, scans) ;
+        return false ;
+    }
+    // Written only when not set, hot slots stay shared between cores
+    if ( !__atomic_load_n(&cache->refs[slot], __ATOMIC_RELAXED) ) __atomic_store_n(&cache->refs[slot], 1, __ATOMIC_RELAXED) ;
+    count_atomic(cache, STAT_HITS, scans) ;
+    return true ;
+}
+
+bool ihtAtomicCacheFetch(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue *value_out)
+{
+    uint64_t hash = fast_key_hash_width(key, true) ;
+    IhtIndex bucket = atomic_bucket(cache, hash) ;
+    for (;;) {
+        uint64_t ctrl ;
+        IhtCacheFastValue value ;
+        IhtIndex slot = atomic_find(cache, key, hash, 0, cache->filler != NULL, &ctrl, &value) ;
+        if ( slot >= 0 && (ctrl & ATOMIC_STATE_MASK) == ATOMIC_READY ) {
+            if ( !__atomic_load_n(&cache->refs[slot], __ATOMIC_RELAXED) ) __atomic_store_n(&cache->refs[slot], 1, __ATOMIC_RELAXED) ;
+            count_atomic(cache, STAT_HITS, slot - bucket) ;
+            *value_out = value ;
+            return true ;
+        }
+        if ( slot >= 0 ) {
+            FillResult result = atomic_wait_fill(cache, slot, ctrl, value_out) ;
+            if ( result == FILL_LOST ) continue ;
+            count_atomic(cache, STAT_MISSES, slot - bucket) ;
+            count_atomic(cache, STAT_SHARED_FILLS, 0) ;
+            return result == FILL_DONE ;
+        }
+        if ( !cache->filler ) {
+            count_atomic(cache, STAT_MISSES, ATOMIC_BUCKET_SLOTS) ;
+            return false ;
+        }
+
+        bool evicted = false ;
+        slot = atomic_claim(cache, hash, &evicted) ;
+        if ( slot < 0 ) {
+            // Every slot of the bucket is in use, fill without caching
+            count_atomic(cache, STAT_MISSES, ATOMIC_BUCKET_SLOTS) ;
+            return cache->filler(cache->cxt, &key, value_out) ;
+        }
+        IhtIndex scans = slot - bucket ;
+        if ( evicted ) count_atomic(cache, STAT_EVICTIONS, scans) ;
+        atomic_store_key(cache, slot, key) ;
+        ctrl = (__atomic_load_n(&cache->ctrl[slot], __ATOMIC_RELAXED) & ~ATOMIC_STATE_MASK) | ATOMIC_FILLING ;
+        __atomic_store_n(&cache->ctrl[slot], ctrl, __ATOMIC_RELEASE) ;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST) ;
+
+        // Of two fetches publishing filling slots, at least one sees the slot of the
+        // other. The fetch with the higher slot steps back, and the one with the lower
+        // slot waits for a fill it sees, whose fetch may not have seen it. Waits go from
+        // lower to higher slots, so they do not form cycles.
+        uint64_t other_ctrl ;
+        FillResult shared = FILL_LOST ;
+        IhtIndex other = atomic_find(cache, key, hash, 0, true, &other_ctrl, NULL) ;
+        while ( other == slot ) {
+            other = atomic_find(cache, key, hash, (int) (slot + 1 - bucket), true, &other_ctrl, NULL) ;
+            if ( other < 0 || (other_ctrl & ATOMIC_STATE_MASK) == ATOMIC_READY ) break ;
+            shared = atomic_wait_fill(cache, other, other_ctrl, value_out) ;
+            if ( shared != FILL_LOST ) break ;
+            other = atomic_find(cache, key, hash, 0, true, &other_ctrl, NULL) ;
+        }
+        if ( other >= 0 ) {
+            atomic_end_fill(cache, slot, atomic_new_key(ctrl, 0, ATOMIC_EMPTY)) ;
+            if ( shared == FILL_LOST ) continue ;   // use the other copy
+            count_atomic(cache, STAT_MISSES, ATOMIC_BUCKET_SLOTS) ;
+            count_atomic(cache, STAT_SHARED_FILLS, 0) ;
+            return shared == FILL_DONE ;
+        }
+
+        count_atomic(cache, STAT_MISSES, ATOMIC_BUCKET_SLOTS) ;
+        if ( !cache->filler(cache->cxt, &key, value_out) ) {
+            atomic_end_fill(cache, slot, ctrl & ~ATOMIC_STATE_MASK) ;
+            return false ;
+        }
+        store_value16(&cache->pairs[slot].value, *value_out) ;
+        ctrl = (ctrl & ~ATOMIC_STATE_MASK) | ATOMIC_READY ;
+        atomic_end_fill(cache, slot, ctrl) ;
+        count_atomic(cache, STAT_ADDS, scans) ;
+        atomic_dedup(cache, key, hash, slot, ctrl) ;
+        return true ;
+    }
+}
+
+bool ihtAtomicCachePut(IhtAtomicCache cache, IhtCacheFastKey key, IhtCacheFastValue value)
+{
+    return atomic_put(cache, key, fast_key_hash_width(key, true), value) ;
+}
+
+bool ihtAtomicCacheRemove(IhtAtomicCache cache, IhtCacheFastKey key)
+{
+    uint64_t hash = fast_key_hash_width(key, true) ;
+    bool removed = false ;
+    // Copies of concurrent puts are removed too
+    for (int i = 0 ; i < ATOMIC_BUCKET_SLOTS ; i++) {
+        uint64_t ctrl ;
+        IhtIndex slot = atomic_find(cache, key, hash, 0, false, &ctrl, NULL) ;
+        if ( slot < 0 ) break ;
+        if ( atomic_remove_slot(cache, slot, ctrl) ) {
+            count_atomic(cache, STAT_REMOVES, slot - atomic_bucket(cache, hash)) ;
+            removed = true ;
+        }
+    }
+    return removed ;
+}
+
+int64_t ihtAtomicCacheGetItemCount(IhtAtomicCache cache)
+{
+    int64_t count = 0 ;
+    for (IhtIndex slot = 0 ; slot < cache->n_slots ; slot++) {
+        count += atomic_readable_bits(__atomic_load_n(&cache->ctrl[slot], __ATOMIC_RELAXED)) == ATOMIC_READY ;
     }
-}
\ No newline at end of file
+    return count ;
+}
+
+int64_t ihtAtomicCacheGetMaxItems(IhtAtomicCache cache)
+{
+    return cache->n_slots ;
+}
+
+void ihtAtomicCacheGetStats(IhtAtomicCache cache, struct IhtCacheStats *out)
+{
+    struct iht_stats total = {} ;
+    add_stripes(&total, cache->stripes) ;
+    *out = (struct IhtCacheStats) {
+#if defined(IHT_NO_STATS)
+        .mode = IHT_STATS_NONE,
+#else
+        .mode = IHT_STATS_PER_THREAD,
+#endif
+        .policy = IHT_EVICT_CLOCK,
+        .lookups = total.counters[STAT_HITS].count + total.counters[STAT_MISSES].count,
+        .hits = total.counters[STAT_HITS],
+        .misses = total.counters[STAT_MISSES],
+        .adds = total.counters[STAT_ADDS],
+        .updates = total.counters[STAT_UPDATES],
+        .evictions = total.counters[STAT_EVICTIONS],
+        .removes = total.counters[STAT_REMOVES],
+        .shared_fills = total.counters[STAT_SHARED_FILLS].count,
+    } ;
+}
+
+void ihtAtomicCachePrintStats(FILE *fp, IhtAtomicCache cache, const char *label, int indent, int show_stats)
+{
+    struct IhtCacheStats stats ;
+    ihtAtomicCacheGetStats(cache, &stats) ;
+    print_stats(fp, &stats, label, indent, show_stats) ;
+}
@@ -16,6 +16,14 @@
  *   - Cache with insufficient size
  *   - Cache with shifting keys
  *   - Cache with noise in keys
+ *   - Cache with group probing at high load factor
+ *   - Cache with inline item layout
+ *   - Batched lookups
+ *   - Batched lookups with a batch filler, on a cache with insufficient size
+ *   - Cache with Robin Hood probing at high load factor
+ *   - Header inline hit path (IHT_INLINE_FAST_PATH)
+ *   - Statistics modes (full, sampled, per thread, none)
+ *   - Statistics snapshot: probe length histograms and victim ages
  *  
  */
 
@@ -26,7 +34,10 @@
 #include <getopt.h>
 #include <time.h>
 #include <string.h>
+#include <inttypes.h>
 
+// ihtCacheGet_D_D uses the header inline hit path
+#define IHT_INLINE_FAST_PATH
 #include "index-hash-table.h"
 
 static int error_count ;
@@ -276,6 +287,283 @@ void test_cache_fuzzy(int N, int R, double s0, int show_stats)
     ihtCacheDestroy(c) ;
 }
 
+// Test group probing with high load factor (0.9)
+void test_cache_group_probe(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    ihtCacheSetMaxLoadFactor(c, 0.9) ;
+    ihtCacheSetProbeMode(c, IHT_PROBE_GROUP) ;
+    ihtCacheReconfigure(c);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double y = ihtCacheGet_D_D(c, x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test inline item layout, with smaller cache (N/2) to exercise evictions
+void test_cache_inline(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    ihtCacheSetLayout(c, IHT_LAYOUT_INLINE) ;
+    ihtCacheReconfigure(c);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double y = ihtCacheGet_D_D(c, x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test the header inline hit path: a cache large enough for all keys, most hits
+// are served without calling into the library
+void test_cache_inline_fast_path(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N+100, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    ihtCacheSetLayout(c, IHT_LAYOUT_INLINE) ;
+    ihtCacheReconfigure(c);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double y = ihtCacheGet_D_D(c, x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    int64_t inline_hits = ((struct iht_cache_view *) c)->inline_hits ;
+    // Inline hits are counted with full statistics only
+    bool counted = ihtCacheGetStatsMode(c) == IHT_STATS_FULL ;
+    if ( counted && R > 1 && inline_hits < (int64_t) N * (R-1) / 2 ) {
+        (void) fprintf(stderr, "%s: too few inline hits: %lld\n", __func__, (long long) inline_hits) ;
+        error_count++ ;
+    }
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test the statistics modes: the same lookups counted in each mode
+void test_cache_stats_modes(int N, int R, double s0, int show_stats)
+{
+    const IhtStatsMode modes[] = { IHT_STATS_FULL, IHT_STATS_SAMPLED, IHT_STATS_PER_THREAD, IHT_STATS_NONE } ;
+    const int SAMPLE_RATE = 16 ;
+    for (int m = 0 ; m < (int) (sizeof(modes)/sizeof(modes[0])) ; m++) {
+        double start_t = time_mono() ;
+        IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+        ihtCacheSetStatsMode(c, modes[m], SAMPLE_RATE) ;
+        // Interleaved with another sampled cache, sampling must stay per cache
+        IhtCache other = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+        ihtCacheSetStatsMode(other, IHT_STATS_SAMPLED, 4096) ;
+        const int BLOCK = 100 ;
+        double s = 0 ;
+        for (int r = 0 ; r<R ; r++ ) {
+            int b = r%BLOCK ;
+            for (int i=0 ; i<N ; i++ ) {
+                double x = vv(i+b, BLOCK+N) ;
+                double y = ihtCacheGet_D_D(c, x) ;
+                (void) ihtCacheGet_D_D(other, x) ;
+                s += y ;
+            }
+        }
+        double end_t = time_mono() ;
+        struct IhtCacheStats stats ;
+        ihtCacheGetStats(c, &stats) ;
+        int64_t expected = (int64_t) N * R ;
+        // Statistics may be compiled out (IHT_NO_STATS)
+        bool counted = ihtCacheGetStatsMode(c) != IHT_STATS_NONE ;
+        bool ok = !counted ? stats.lookups == 0 :
+            stats.mode == IHT_STATS_SAMPLED ? llabs(stats.lookups - expected) <= expected / 20 + SAMPLE_RATE :
+            stats.lookups == expected ;
+        if ( stats.mode != ihtCacheGetStatsMode(c) || !ok ) {
+            (void) fprintf(stderr, "%s: mode %d: lookups=%lld expected=%lld\n", __func__, (int) modes[m], (long long) stats.lookups, (long long) expected) ;
+            error_count++ ;
+        }
+        check_test(__func__, end_t - start_t, s0, s/R/N) ;
+        show_test_details(c, __func__, show_stats) ;
+        ihtCacheDestroy(c) ;
+        ihtCacheDestroy(other) ;
+    }
+}
+
+static bool check_histogram(const char *label, const int64_t *hist, int n, int64_t count)
+{
+    int64_t total = 0 ;
+    for (int b = 0 ; b < n ; b++) total += hist[b] ;
+    if ( total == count ) return true ;
+    (void) fprintf(stderr, "%s: histogram total %lld != count %lld\n", label, (long long) total, (long long) count) ;
+    return false ;
+}
+
+// Test the statistics snapshot with a cache too small for the keys: the histograms
+// add up to the operation counts, and every eviction has a victim age
+void test_cache_stats_snapshot(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double y = ihtCacheGet_D_D(c, x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    struct IhtCacheStats stats ;
+    ihtCacheGetStats(c, &stats) ;
+    bool ok = check_histogram("hits", stats.hits.probe_hist, IHT_PROBE_BUCKETS, stats.hits.count) &&
+        check_histogram("misses", stats.misses.probe_hist, IHT_PROBE_BUCKETS, stats.misses.count) &&
+        check_histogram("adds", stats.adds.probe_hist, IHT_PROBE_BUCKETS, stats.adds.count) &&
+        check_histogram("evictions", stats.evictions.probe_hist, IHT_PROBE_BUCKETS, stats.evictions.count) &&
+        check_histogram("victim ages", stats.victim_ages, IHT_VICTIM_AGES, stats.evictions.count) ;
+    if ( ihtCacheGetStatsMode(c) != IHT_STATS_NONE && (stats.evictions.count == 0 || stats.lookups != (int64_t) N * R) ) ok = false ;
+    if ( !ok ) {
+        (void) fprintf(stderr, "%s: inconsistent statistics\n", __func__) ;
+        error_count++ ;
+    }
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats ? 3 : 0) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test batched lookups, one batch per round
+void test_cache_batch(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    IhtCacheFastKey *keys = calloc(N, sizeof(*keys)) ;
+    IhtCacheFastValue *values = calloc(N, sizeof(*values)) ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            memcpy(&keys[i], &x, sizeof(x)) ;
+        }
+        if ( ihtCacheGetBatch_Fast(c, N, keys, values, NULL) ) error_count++ ;
+        for (int i=0 ; i<N ; i++ ) {
+            double y ;
+            memcpy(&y, &values[i], sizeof(y)) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    free(keys) ;
+    free(values) ;
+    ihtCacheDestroy(c) ;
+}
+
+struct batch_fills {
+    int64_t calls ;
+    int64_t keys ;
+} ;
+
+static void exp_batch_filler(void *cxt, const void *keys, int n, void *values_out, uint64_t *ok_mask)
+{
+    struct batch_fills *fills = cxt ;
+    fills->calls++ ;
+    fills->keys += n ;
+    const double *x = keys ;
+    double *y = values_out ;
+    for (int i = 0 ; i < n ; i++ ) y[i] = exp(x[i]) ;
+    for (int i = 0 ; i < n ; i++ ) ok_mask[i/64] |= 1ULL << (i%64) ;
+}
+
+// Test batched lookups with a batch filler, on a cache too small for the keys (N/2):
+// each batch has misses, filled by one call
+void test_cache_batch_filler(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    struct batch_fills fills = { 0 } ;
+    IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), NULL, &fills);
+    ihtCacheSetBatchFiller(c, exp_batch_filler) ;
+    IhtCacheFastKey *keys = calloc(N, sizeof(*keys)) ;
+    IhtCacheFastValue *values = calloc(N, sizeof(*values)) ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            memcpy(&keys[i], &x, sizeof(x)) ;
+        }
+        if ( ihtCacheGetBatch_Fast(c, N, keys, values, NULL) ) error_count++ ;
+        for (int i=0 ; i<N ; i++ ) {
+            double y ;
+            memcpy(&y, &values[i], sizeof(y)) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    struct IhtCacheStats stats ;
+    ihtCacheGetStats(c, &stats) ;
+    // Statistics may be compiled out (IHT_NO_STATS)
+    bool counted = ihtCacheGetStatsMode(c) != IHT_STATS_NONE ;
+    if ( fills.calls > R || (counted && (fills.keys != stats.misses.count || stats.adds.count != fills.keys)) ) {
+        (void) fprintf(stderr, "%s: %" PRId64 " batch fills of %" PRId64 " keys, %" PRId64 " misses\n", __func__, fills.calls, fills.keys, stats.misses.count) ;
+        error_count++ ;
+    }
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    free(keys) ;
+    free(values) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test Robin Hood probing with high load factor (0.9), inline items and
+// smaller cache (N/2), so that evictions shift entries
+void test_cache_robin_hood(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    ihtCacheSetMaxLoadFactor(c, 0.9) ;
+    ihtCacheSetProbeMode(c, IHT_PROBE_ROBIN_HOOD) ;
+    ihtCacheSetLayout(c, IHT_LAYOUT_INLINE) ;
+    ihtCacheReconfigure(c);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double y = ihtCacheGet_D_D(c, x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
 // Invoke with '-nN' and '-rR' to set N and R valuee
 // Default
 
@@ -325,6 +613,14 @@ int main(int argc, char **argv) {
     if ( run_test('E', test_select) ) test_cache_shift(N, R, exp_result, show_stats) ;
     if ( run_test('F', test_select) ) test_cache_noise(N, R, exp_result, show_stats) ;
     if ( run_test('G', test_select) ) test_cache_fuzzy(N, R, exp_result, show_stats);
+    if ( run_test('H', test_select) ) test_cache_group_probe(N, R, exp_result, show_stats);
+    if ( run_test('I', test_select) ) test_cache_inline(N, R, exp_result, show_stats);
+    if ( run_test('J', test_select) ) test_cache_batch(N, R, exp_result, show_stats);
+    if ( run_test('K', test_select) ) test_cache_robin_hood(N, R, exp_result, show_stats);
+    if ( run_test('L', test_select) ) test_cache_inline_fast_path(N, R, exp_result, show_stats);
+    if ( run_test('M', test_select) ) test_cache_stats_modes(N, R, exp_result, show_stats);
+    if ( run_test('N', test_select) ) test_cache_stats_snapshot(N, R, exp_result, show_stats);
+    if ( run_test('O', test_select) ) test_cache_batch_filler(N, R, exp_result, show_stats);
     free(test_select) ;
     return error_count ? EXIT_FAILURE : EXIT_SUCCESS ;
 }
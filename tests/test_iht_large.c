@@ -16,6 +16,11 @@
  *   - Cache with insufficient size
  *   - Cache with shifting keys
  *   - Cache with noise in keys
+ *   - Cache with group probing at high load factor
+ *   - Batched lookups
+ *   - Cache with Robin Hood probing at high load factor
+ *   - Cache with 64-bit capacity and wide entries
+ *   - Wide key/value API (32-byte keys and values)
  *  
  */
 
@@ -328,6 +333,134 @@ void test_cache_fuzzy(int N, int R, double s0, int show_stats)
     ihtCacheDestroy(c) ;
 }
 
+// Test group probing with high load factor (0.9)
+void test_cache_group_probe(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(struct t_key), sizeof(struct t_value), exp_wrapper, NULL);
+    ihtCacheSetMaxLoadFactor(c, 0.9) ;
+    ihtCacheSetProbeMode(c, IHT_PROBE_GROUP) ;
+    ihtCacheReconfigure(c);
+    struct t_key key ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            set_key(i+b, BLOCK+N, &key) ;
+            struct t_value *value = ihtCacheGet(c, &key) ;
+            s += value->y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test batched lookups, one batch per round
+void test_cache_batch(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(struct t_key), sizeof(struct t_value), exp_wrapper, NULL);
+    struct t_key *keys = calloc(N, sizeof(*keys)) ;
+    struct t_value *values = calloc(N, sizeof(*values)) ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            set_key(i+b, BLOCK+N, &keys[i]) ;
+        }
+        if ( ihtCacheGetBatch(c, N, keys, values, NULL) ) error_count++ ;
+        for (int i=0 ; i<N ; i++ ) {
+            s += values[i].y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    free(keys) ;
+    free(values) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test Robin Hood probing with high load factor (0.9)
+void test_cache_robin_hood(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(struct t_key), sizeof(struct t_value), exp_wrapper, NULL);
+    ihtCacheSetMaxLoadFactor(c, 0.9) ;
+    ihtCacheSetProbeMode(c, IHT_PROBE_ROBIN_HOOD) ;
+    ihtCacheReconfigure(c);
+    struct t_key key ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            set_key(i+b, BLOCK+N, &key) ;
+            struct t_value *value = ihtCacheGet(c, &key) ;
+            s += value->y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test with 64-bit capacity API, and wide (64-bit hash) entries
+void test_cache_wide(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate64((int64_t) N, sizeof(struct t_key), sizeof(struct t_value), exp_wrapper, NULL);
+    ihtCacheSetWideIndex(c, true) ;
+    ihtCacheReconfigure(c);
+    struct t_key key ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            set_key(i+b, BLOCK+N, &key) ;
+            struct t_value *value = ihtCacheGet(c, &key) ;
+            s += value->y ;
+        }
+    }
+    double end_t = time_mono() ;
+    if ( !ihtCacheGetWideIndex(c) || ihtCacheGetItemCount64(c) != ihtCacheGetItemCount(c) ) {
+        (void) fprintf(stderr, "%s: wide index not in use\n", __func__) ;
+        error_count++ ;
+    }
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test the wide key/value API, passing the 4-double key and value as wide structs
+void test_cache_get_wide(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(struct t_key), sizeof(struct t_value), exp_wrapper, NULL);
+    union wide_key { struct t_key k ; IhtCacheWideKey w ; } key ;
+    union wide_value { struct t_value v ; IhtCacheWideValue w ; } value ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            set_key(i+b, BLOCK+N, &key.k) ;
+            value.w = ihtCacheGet_Wide(c, key.w) ;
+            s += value.v.y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
 // Invoke with '-nN' and '-rR' to set N and R valuee
 // Default
 
@@ -377,6 +510,11 @@ int main(int argc, char **argv) {
     if ( run_test('E', test_select) ) test_cache_shift(N, R, exp_result, show_stats) ;
     if ( run_test('F', test_select) ) test_cache_noise(N, R, exp_result, show_stats) ;
     if ( run_test('G', test_select) ) test_cache_fuzzy(N, R, exp_result, show_stats);
+    if ( run_test('H', test_select) ) test_cache_group_probe(N, R, exp_result, show_stats);
+    if ( run_test('I', test_select) ) test_cache_batch(N, R, exp_result, show_stats);
+    if ( run_test('J', test_select) ) test_cache_robin_hood(N, R, exp_result, show_stats);
+    if ( run_test('K', test_select) ) test_cache_wide(N, R, exp_result, show_stats);
+    if ( run_test('L', test_select) ) test_cache_get_wide(N, R, exp_result, show_stats);
     free(test_select) ;
     return error_count ? EXIT_FAILURE : EXIT_SUCCESS ;
 }
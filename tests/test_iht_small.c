@@ -16,6 +16,16 @@
  *   - Cache with insufficient size
  *   - Cache with shifting keys
  *   - Cache with noise in keys
+ *   - Cache with fuzzy keys
+ *   - Cache with keys invalidated (removed) while running
+ *   - Cache cleared (remove all) every 10 rounds
+ *   - Cache resized (N/2 to N, and back) while running
+ *   - Cache with insufficient size, for each eviction policy
+ *   - Cache with insufficient size and fuzzy keys, with TinyLFU admission
+ *   - Keys rejected by TinyLFU admission do not change the next evictions, for each
+ *     eviction policy
+ *   - Cache with insufficient size and fillers of mixed cost, with cost aware eviction
+ *   - Cache with adaptive bypass, with NOP and exponential operations
  *  
  */
 
@@ -26,6 +36,7 @@
 #include <getopt.h>
 #include <time.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "index-hash-table.h"
 
@@ -133,6 +144,19 @@ static bool exp_wrapper(void *cxt, const void *param, void *result)
     return true ;
 }
 
+// exp() that is much slower for half of the keys, counting the slow calls in cxt
+static bool slow_exp_wrapper(void *cxt, const void *param, void *result)
+{
+    double x = *(double*) param ;
+    if ( ((long) (x*100)) % 2 == 0 ) {
+        volatile double spin = x ;
+        for (int i = 0 ; i < 500 ; i++) spin = spin * 0.5 + 1 ;
+        (*(long *) cxt)++ ;
+    }
+    *(double *) result = exp(x) ;
+    return true ;
+}
+
 void test_cache_nop(int N, int R, double s0, int show_stats)
 {
     double start_t = time_mono() ;
@@ -278,6 +302,299 @@ void test_cache_fuzzy(int N, int R, double s0, int show_stats)
     ihtCacheDestroy(c) ;
 }
 
+// Test with every 10th key removed after use, and looked up again on the next round
+void test_cache_remove(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    ihtCacheSetMaxLoadFactor(c, 0.9) ;
+    ihtCacheReconfigure(c);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double *y = ihtCacheGet(c, &x) ;
+            s += *y ;
+            if ( (i%10) == 0 ) {
+                if ( !ihtCacheRemove(c, &x) || ihtCacheRemove(c, &x) ) {
+                    (void) fprintf(stderr, "%s: remove of %g failed\n", __func__, x) ;
+                    error_count++ ;
+                }
+            }
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test with the whole cache cleared every 10 rounds
+void test_cache_remove_all(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        if ( (r%10) == 9 ) ihtCacheRemoveAll(c) ;
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double *y = ihtCacheGet(c, &x) ;
+            s += *y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test with cache growing from N/2 to N, and shrinking back, keeping the content
+void test_cache_resize(int N, int R, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        int b = r%BLOCK ;
+        if ( r == R/4 || r == 3*R/4 ) {
+            ihtCacheSetMinCapacity(c, r == R/4 ? N : N/2) ;
+            ihtCacheResize(c) ;
+        }
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+b, BLOCK+N) ;
+            double *y = ihtCacheGet(c, &x) ;
+            s += *y ;
+        }
+    }
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, s/R/N) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtCacheDestroy(c) ;
+}
+
+// Test each eviction policy with a cache too small for the keys, with removes, a
+// remove all and a resize while running
+void test_cache_policies(int N, int R, double s0, int show_stats)
+{
+    static const IhtEvictionPolicy policies[] = { IHT_EVICT_CLOCK, IHT_EVICT_SIEVE, IHT_EVICT_S3FIFO, IHT_EVICT_SAMPLED_LRU } ;
+    static const char *names[] = { "clock", "sieve", "s3fifo", "sampled_lru" } ;
+    const int BLOCK = 100 ;
+    for (int p = 0 ; p < 4 ; p++ ) {
+        double start_t = time_mono() ;
+        IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+        ihtCacheSetEvictionPolicy(c, policies[p]) ;
+        ihtCacheReconfigure(c) ;
+        double s = 0 ;
+        for (int r = 0 ; r<R ; r++ ) {
+            int b = r%BLOCK ;
+            if ( r == R/2 ) {
+                ihtCacheSetMinCapacity(c, N/4) ;
+                ihtCacheResize(c) ;
+            }
+            if ( (r%50) == 49 ) ihtCacheRemoveAll(c) ;
+            for (int i=0 ; i<N ; i++ ) {
+                double x = vv(i+b, BLOCK+N) ;
+                double *y = ihtCacheGet(c, &x) ;
+                s += *y ;
+                if ( (i%7) == 0 ) ihtCacheRemove(c, &x) ;
+            }
+        }
+        double end_t = time_mono() ;
+        char test_name[64] ;
+        (void) snprintf(test_name, sizeof(test_name), "%s(%s)", __func__, names[p]) ;
+        check_test(test_name, end_t - start_t, s0, s/R/N) ;
+        struct IhtCacheStats stats ;
+        ihtCacheGetStats(c, &stats) ;
+        if ( stats.policy != policies[p] || ihtCacheGetEvictionPolicy(c) != policies[p] ||
+             (ihtCacheGetStatsMode(c) == IHT_STATS_FULL && stats.evictions.count == 0) ) {
+            (void) fprintf(stderr, "FAILED: %s: policy=%d evictions=%ld\n", test_name, (int) stats.policy, (long) stats.evictions.count) ;
+            error_count++ ;
+        }
+        show_test_details(c, test_name, show_stats) ;
+        ihtCacheDestroy(c) ;
+    }
+}
+
+// Test the admission filter with fuzzy keys, in a cache too small for the keys: the
+// one time keys should not push out the repeated ones
+void test_cache_admission(int N, int R, double s0, int show_stats)
+{
+    const int BLOCK = 100 ;
+    double hit_rate[2] = { 0 } ;
+    for (int admission = IHT_ADMIT_ALL ; admission <= IHT_ADMIT_TINYLFU ; admission++ ) {
+        double start_t = time_mono() ;
+        IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+        ihtCacheSetAdmission(c, admission) ;
+        ihtCacheReconfigure(c) ;
+        double s = 0 ;
+        for (int r = 0 ; r<R ; r++ ) {
+            int b = r%BLOCK ;
+            for (int i=0 ; i<N ; i++ ) {
+                double x = vv(i+b, BLOCK+N) + ((i%3) ? 0.0 : v_noise(r, R));
+                double *y = ihtCacheGet(c, &x) ;
+                s += *y ;
+            }
+        }
+        double end_t = time_mono() ;
+        const char *test_name = admission ? "test_cache_admission(tinylfu)" : "test_cache_admission(all)" ;
+        check_test(test_name, end_t - start_t, s0, s/R/N) ;
+        struct IhtCacheStats stats ;
+        ihtCacheGetStats(c, &stats) ;
+        hit_rate[admission] = (double) stats.hits.count / (stats.lookups + !stats.lookups) ;
+        if ( admission && ihtCacheGetStatsMode(c) == IHT_STATS_FULL && stats.rejects == 0 ) {
+            (void) fprintf(stderr, "FAILED: %s: no rejects\n", test_name) ;
+            error_count++ ;
+        }
+        show_test_details(c, test_name, show_stats) ;
+        ihtCacheDestroy(c) ;
+    }
+    if ( hit_rate[IHT_ADMIT_TINYLFU] < hit_rate[IHT_ADMIT_ALL] ) {
+        (void) fprintf(stderr, "FAILED: %s: hit rate %.3f with admission, %.3f without\n", __func__,
+            hit_rate[IHT_ADMIT_TINYLFU], hit_rate[IHT_ADMIT_ALL]) ;
+        error_count++ ;
+    }
+}
+
+// Test that keys rejected by the admission filter leave the eviction policy state as it
+// was: two caches get the same keys, one of them also one time keys (mostly rejected,
+// the few admitted ones are put in the other cache too), then both get new keys with
+// puts (not filtered). The same entries must be evicted.
+// GreedyDual is left out: the filler calls are timed, and the extra fills change
+// the cost of the new keys.
+void test_cache_admission_noise(int N, int R, double s0, int show_stats)
+{
+    (void) R ; (void) s0 ;
+    static const IhtEvictionPolicy policies[] = { IHT_EVICT_CLOCK, IHT_EVICT_SIEVE, IHT_EVICT_S3FIFO, IHT_EVICT_SAMPLED_LRU } ;
+    static const char *names[] = { "clock", "sieve", "s3fifo", "sampled_lru" } ;
+    for (int p = 0 ; p < 4 ; p++ ) {
+        double start_t = time_mono() ;
+        IhtCache c[2] ;
+        int64_t rejects = 0 ;
+        for (int k = 0 ; k < 2 ; k++ ) {
+            c[k] = ihtCacheCreate(N/2, sizeof(double), sizeof(double), exp_wrapper, NULL);
+            ihtCacheSetEvictionPolicy(c[k], policies[p]) ;
+            ihtCacheSetAdmission(c[k], IHT_ADMIT_TINYLFU) ;
+            ihtCacheReconfigure(c[k]) ;
+        }
+        int n_keys = (int) ihtCacheGetMaxItems64(c[0]) ;
+        for (int k = 0 ; k < 2 ; k++ ) {
+            // Each key twice, to pass the admission filter
+            for (int i = 0 ; i < n_keys ; i++ ) {
+                double x = i ;
+                for (int use = 0 ; use < 2 ; use++ ) (void) ihtCacheGet(c[k], &x) ;
+            }
+        }
+        struct IhtCacheStats filled ;
+        ihtCacheGetStats(c[1], &filled) ;
+        for (int i = 0 ; i < N/8 ; i++ ) {
+            double x = n_keys + 0.5 + i, y ;
+            (void) ihtCacheGet(c[1], &x) ;
+            if ( ihtCacheLookup(c[1], &x, &y) ) {
+                (void) ihtCachePut(c[0], &x, &y) ;
+                (void) ihtCacheLookup(c[0], &x, &y) ;
+            }
+        }
+        for (int i = 0 ; i < n_keys/8 ; i++ ) {
+            double x = -1.0 - i ;
+            for (int k = 0 ; k < 2 ; k++ ) (void) ihtCachePut(c[k], &x, &x) ;
+        }
+        struct IhtCacheStats noisy ;
+        ihtCacheGetStats(c[1], &noisy) ;
+        rejects = noisy.rejects - filled.rejects ;
+        int differences = 0 ;
+        for (int i = 0 ; i < n_keys ; i++ ) {
+            double x = i, y ;
+            differences += ihtCacheLookup(c[0], &x, &y) != ihtCacheLookup(c[1], &x, &y) ;
+        }
+        double end_t = time_mono() ;
+        char test_name[64] ;
+        (void) snprintf(test_name, sizeof(test_name), "%s(%s)", __func__, names[p]) ;
+        (void) fprintf(stderr, "%s (%.3f seconds): %d different entries\n", test_name, end_t - start_t, differences) ;
+        // Most one time keys must be rejected (statistics may be compiled out)
+        bool rejected = ihtCacheGetStatsMode(c[1]) != IHT_STATS_FULL || rejects >= N/10 ;
+        if ( differences || !rejected ) {
+            (void) fprintf(stderr, "FAILED: %s: %d different entries, %" PRId64 " rejects\n", test_name, differences, rejects) ;
+            error_count++ ;
+        }
+        show_test_details(c[1], test_name, show_stats) ;
+        for (int k = 0 ; k < 2 ; k++ ) ihtCacheDestroy(c[k]) ;
+    }
+}
+
+// Test cost aware eviction with a cache too small for the keys, when half of the
+// keys are slow to fill: they should be filled less often than with CLOCK
+void test_cache_cost_aware(int N, int R, double s0, int show_stats)
+{
+    const int BLOCK = 100 ;
+    static const IhtEvictionPolicy policies[] = { IHT_EVICT_CLOCK, IHT_EVICT_GREEDY_DUAL } ;
+    static const char *names[] = { "test_cache_cost_aware(clock)", "test_cache_cost_aware(greedy_dual)" } ;
+    long slow_fills[2] = { 0 } ;
+    for (int p = 0 ; p < 2 ; p++ ) {
+        double start_t = time_mono() ;
+        IhtCache c = ihtCacheCreate(N/2, sizeof(double), sizeof(double), slow_exp_wrapper, &slow_fills[p]);
+        ihtCacheSetEvictionPolicy(c, policies[p]) ;
+        ihtCacheReconfigure(c) ;
+        double s = 0 ;
+        for (int r = 0 ; r<R ; r++ ) {
+            int b = r%BLOCK ;
+            for (int i=0 ; i<N ; i++ ) {
+                double x = vv(i+b, BLOCK+N) ;
+                double *y = ihtCacheGet(c, &x) ;
+                s += *y ;
+            }
+        }
+        double end_t = time_mono() ;
+        check_test(names[p], end_t - start_t, s0, s/R/N) ;
+        show_test_details(c, names[p], show_stats) ;
+        ihtCacheDestroy(c) ;
+    }
+    (void) fprintf(stderr, "%s: slow fills %ld with clock, %ld with greedy dual\n", __func__, slow_fills[0], slow_fills[1]) ;
+    if ( slow_fills[1] >= slow_fills[0] ) {
+        (void) fprintf(stderr, "FAILED: %s: cost aware eviction did not reduce the slow fills\n", __func__) ;
+        error_count++ ;
+    }
+}
+
+// Test the adaptive bypass: NOP is cheaper than a cache lookup and should be passed
+// through, at least some of the time. Results must be the same either way.
+void test_cache_bypass(int N, int R, double nop_s0, double exp_s0, int show_stats)
+{
+    const int BLOCK = 100 ;
+    static const char *names[] = { "test_cache_bypass(nop)", "test_cache_bypass(exp)" } ;
+    ihtCacheFiller fillers[] = { nop_wrapper, exp_wrapper } ;
+    double s0[] = { nop_s0, exp_s0 } ;
+    for (int f = 0 ; f < 2 ; f++ ) {
+        double start_t = time_mono() ;
+        IhtCache c = ihtCacheCreate(N, sizeof(double), sizeof(double), fillers[f], NULL);
+        ihtCacheSetAdaptiveBypass(c, true) ;
+        double s = 0 ;
+        for (int r = 0 ; r<R ; r++ ) {
+            int b = r%BLOCK ;
+            for (int i=0 ; i<N ; i++ ) {
+                double x = vv(i+b, BLOCK+N) ;
+                double *y = ihtCacheGet(c, &x) ;
+                s += *y ;
+            }
+        }
+        double end_t = time_mono() ;
+        check_test(names[f], end_t - start_t, s0[f], s/R/N) ;
+        struct IhtCacheStats stats ;
+        ihtCacheGetStats(c, &stats) ;
+        if ( f == 0 && ihtCacheGetStatsMode(c) == IHT_STATS_FULL && stats.passes == 0 ) {
+            (void) fprintf(stderr, "FAILED: %s: no pass through\n", names[f]) ;
+            error_count++ ;
+        }
+        show_test_details(c, names[f], show_stats) ;
+        ihtCacheDestroy(c) ;
+    }
+}
+
 // Invoke with '-nN' and '-rR' to set N and R valuee
 // Default
 static bool run_test(int test_id, const char *test_select)
@@ -326,6 +643,14 @@ int main(int argc, char **argv) {
     if ( run_test('E', test_select) ) test_cache_shift(N, R, exp_result, show_stats) ;
     if ( run_test('F', test_select) ) test_cache_noise(N, R, exp_result, show_stats) ;
     if ( run_test('G', test_select) ) test_cache_fuzzy(N, R, exp_result, show_stats);
+    if ( run_test('H', test_select) ) test_cache_remove(N, R, exp_result, show_stats) ;
+    if ( run_test('I', test_select) ) test_cache_remove_all(N, R, exp_result, show_stats) ;
+    if ( run_test('J', test_select) ) test_cache_resize(N, R, exp_result, show_stats) ;
+    if ( run_test('K', test_select) ) test_cache_policies(N, R, exp_result, show_stats) ;
+    if ( run_test('L', test_select) ) test_cache_admission(N, R, exp_result, show_stats) ;
+    if ( run_test('M', test_select) ) test_cache_cost_aware(N, R, exp_result, show_stats) ;
+    if ( run_test('N', test_select) ) test_cache_bypass(N, R, nop_result, exp_result, show_stats) ;
+    if ( run_test('O', test_select) ) test_cache_admission_noise(N, R, exp_result, show_stats) ;
     free(test_select) ;
     return error_count ? EXIT_FAILURE : EXIT_SUCCESS ;
 }
@@ -0,0 +1,709 @@
+/**
+ * @file
+ * @brief Test iht sharded cache with concurrent threads (1K, double key, double value)
+ *
+ * @details
+ * This test suite runs the index-hash-table (IHT) sharded cache from several threads
+ * sharing one cache. Each thread takes every T-th round of the key sequence. It runs
+ * the following tests:
+ * - Exponential operation: Computes the exponential of the input value.
+ * - Sharded cache tests, with exponential operations:
+ *   - Standard cache test (fast key/value API)
+ *   - Cache with insufficient size
+ *   - Generic key/value API (24 byte keys), with puts and removes while running
+ *   - Throughput with 1, 2, 4, ... threads
+ *   - Optimistic (lock-free) reads, with the fast and generic APIs
+ *   - Slow fills: threads waiting for the shard lock while the filler runs sleep,
+ *     and each key is filled once
+ * - Lock-free atomic cache tests:
+ *   - Standard and insufficient size cache tests, with exponential operations
+ *   - Linearizability stress test: writers put and remove their own keys while readers
+ *     check every value seen against the writer progress; then all threads put the
+ *     same keys, checking that keys and values are never mixed up
+ *   - Single-flight fills: threads fetching the same missing keys with a slow filler
+ *     call it once per key, and all get the filled value (or the fill failure)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "index-hash-table.h"
+
+static int error_count ;
+
+static inline double time_hires(void)
+{
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    double now = (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9 ;
+    return now ;
+}
+
+static double time_mono(void)
+{
+    static double base_time ;
+    double now = time_hires() ;
+    if ( base_time == 0 ) base_time =now ;
+    return now - base_time ;
+}
+
+static void check_test(const char *test_name, double dt, double expected, double result)
+{
+    double error = 2*(result - expected)/(expected + result) ;
+    (void) fprintf(stderr, "%s (%.3f seconds): Diff=%.2f (V=%.3f)\n", test_name, dt, 100.0*error, result) ;
+    if ( fabs(error) > 0.05 ) {
+        (void) fprintf(stderr, "FAILED: %s (%.3f seconds): Error=%.2f (V=%.3f)\n", test_name, dt, 100.0*error, result) ;
+        error_count ++ ;
+    }
+
+}
+
+static void show_test_details(IhtShardedCache c, const char *test_name, int show_stats)
+{
+    if ( !show_stats) return ;
+    ihtShardedCachePrintStats(stdout, c, test_name, 2, show_stats) ;
+}
+
+static inline double vv(int pos, int count)
+{
+    return 0.5 + (9.5*(pos%count))/count ;
+}
+
+static double test_exp(int N, int R)
+{
+    double start_t = time_mono() ;
+    double s = 0 ;
+    const int BLOCK = 100 ;
+    for (int r = 0 ; r<R ; r++ ) {
+        for (int i=0 ; i<N ; i++ ) {
+            double x = vv(i+r%BLOCK, BLOCK+N) ;
+            double y = exp(x) ;
+            s += y ;
+        }
+    }
+    double end_t = time_mono() ;
+    double result = s/R/N ;
+    printf("%s (%.3f seconds): V=%.3f\n", __func__, end_t - start_t, result) ;
+    return result ;
+}
+
+static bool exp_wrapper(void *cxt, const void *param, void *result)
+{
+    (void) cxt ;
+    double x = *(double*) param ;
+    double v = exp(x) ;
+    *(double *) result = v ;
+    return true ;
+}
+
+// 24 byte keys: the value is the exponential of the first double
+static bool exp3_wrapper(void *cxt, const void *param, void *result)
+{
+    (void) cxt ;
+    const double *x = param ;
+    *(double *) result = exp(x[0]) ;
+    return true ;
+}
+
+// Work of one thread: rounds thread, thread+T, thread+2T, ...
+struct thread_work {
+    IhtShardedCache cache ;
+    int thread ;
+    int n_threads ;
+    int N ;
+    int R ;
+    double sum ;
+    int errors ;
+} ;
+
+static void *run_fast(void *arg)
+{
+    struct thread_work *work = arg ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = work->thread ; r<work->R ; r += work->n_threads ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<work->N ; i++ ) {
+            double x = vv(i+b, BLOCK+work->N) ;
+            IhtCacheFastKey key = { 0 } ;
+            memcpy(&key, &x, sizeof(x)) ;
+            IhtCacheFastValue value = ihtShardedCacheGet_Fast(work->cache, key) ;
+            double y ;
+            memcpy(&y, &value, sizeof(y)) ;
+            s += y ;
+        }
+    }
+    work->sum = s ;
+    return NULL ;
+}
+
+// Generic keys, with each thread also putting and removing keys. Values put are the
+// ones the filler computes, so every fetch must return exp() of the key.
+static void *run_generic(void *arg)
+{
+    struct thread_work *work = arg ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = work->thread ; r<work->R ; r += work->n_threads ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<work->N ; i++ ) {
+            double key[3] = { vv(i+b, BLOCK+work->N), 1.0, 2.0 } ;
+            double y ;
+            if ( i % 13 == work->thread ) {
+                (void) ihtShardedCacheRemove(work->cache, key) ;
+            } else if ( i % 17 == work->thread ) {
+                y = exp(key[0]) ;
+                (void) ihtShardedCachePut(work->cache, key, &y) ;
+            }
+            if ( !ihtShardedCacheFetch(work->cache, key, &y) || y != exp(key[0]) ) work->errors++ ;
+            s += y ;
+        }
+    }
+    work->sum = s ;
+    return NULL ;
+}
+
+// Run the N x R lookups on T threads, returns the average value
+static double run_threads(IhtShardedCache c, int T, int N, int R, bool generic)
+{
+    pthread_t threads[T] ;
+    struct thread_work work[T] ;
+    for (int t = 0 ; t < T ; t++ ) {
+        work[t] = (struct thread_work) { .cache = c, .thread = t, .n_threads = T, .N = N, .R = R } ;
+        (void) pthread_create(&threads[t], NULL, generic ? run_generic : run_fast, &work[t]) ;
+    }
+    double s = 0 ;
+    for (int t = 0 ; t < T ; t++ ) {
+        (void) pthread_join(threads[t], NULL) ;
+        s += work[t].sum ;
+        if ( work[t].errors ) {
+            (void) fprintf(stderr, "FAILED: thread %d: %d wrong values\n", t, work[t].errors) ;
+            error_count++ ;
+        }
+    }
+    return s/R/N ;
+}
+
+void test_sharded_exp(int N, int R, int T, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtShardedCache c = ihtShardedCacheCreate(N, 4*T, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    double result = run_threads(c, T, N, R, false) ;
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, result) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtShardedCacheDestroy(c) ;
+}
+
+void test_sharded_too_small(int N, int R, int T, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtShardedCache c = ihtShardedCacheCreate(N/2, 4*T, sizeof(double), sizeof(double), exp_wrapper, NULL);
+    double result = run_threads(c, T, N, R, false) ;
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, result) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtShardedCacheDestroy(c) ;
+}
+
+void test_sharded_generic(int N, int R, int T, double s0, int show_stats)
+{
+    double start_t = time_mono() ;
+    IhtShardedCache c = ihtShardedCacheCreate(N, 4*T, 3*sizeof(double), sizeof(double), exp3_wrapper, NULL);
+    double result = run_threads(c, T, N, R, true) ;
+    double end_t = time_mono() ;
+    check_test(__func__, end_t - start_t, s0, result) ;
+    show_test_details(c, __func__, show_stats) ;
+    ihtShardedCacheDestroy(c) ;
+}
+
+// Optimistic reads, with the fast API, then with the generic API and writers
+void test_sharded_optimistic(int N, int R, int T, double s0, int show_stats)
+{
+    static const char *names[] = { "test_sharded_optimistic(fast)", "test_sharded_optimistic(generic)" } ;
+    for (int generic = 0 ; generic < 2 ; generic++ ) {
+        double start_t = time_mono() ;
+        IhtShardedCache c = generic ?
+            ihtShardedCacheCreate(N, 4*T, 3*sizeof(double), sizeof(double), exp3_wrapper, NULL) :
+            ihtShardedCacheCreate(N, 4*T, sizeof(double), sizeof(double), exp_wrapper, NULL) ;
+        ihtShardedCacheSetOptimisticReads(c, true) ;
+        double result = run_threads(c, T, N, R, generic) ;
+        double end_t = time_mono() ;
+        check_test(names[generic], end_t - start_t, s0, result) ;
+        show_test_details(c, names[generic], show_stats) ;
+        ihtShardedCacheDestroy(c) ;
+    }
+}
+
+// Atomic cache: each thread takes every T-th round, values are checked
+struct atomic_work {
+    IhtAtomicCache cache ;
+    int thread ;
+    int n_threads ;
+    int N ;
+    int R ;
+    double sum ;
+    int errors ;
+} ;
+
+static void *run_atomic(void *arg)
+{
+    struct atomic_work *work = arg ;
+    const int BLOCK = 100 ;
+    double s = 0 ;
+    for (int r = work->thread ; r<work->R ; r += work->n_threads ) {
+        int b = r%BLOCK ;
+        for (int i=0 ; i<work->N ; i++ ) {
+            double x = vv(i+b, BLOCK+work->N) ;
+            IhtCacheFastKey key = { 0 } ;
+            memcpy(&key, &x, sizeof(x)) ;
+            IhtCacheFastValue value ;
+            double y = 0 ;
+            if ( !ihtAtomicCacheFetch(work->cache, key, &value) ) work->errors++ ;
+            memcpy(&y, &value, sizeof(y)) ;
+            if ( y != exp(x) ) work->errors++ ;
+            s += y ;
+        }
+    }
+    work->sum = s ;
+    return NULL ;
+}
+
+static bool atomic_exp_wrapper(void *cxt, const void *param, void *result)
+{
+    (void) cxt ;
+    double x = *(double*) param ;
+    IhtCacheFastValue value = { 0 } ;
+    double v = exp(x) ;
+    memcpy(&value, &v, sizeof(v)) ;
+    *(IhtCacheFastValue *) result = value ;
+    return true ;
+}
+
+void test_atomic_exp(int N, int R, int T, double s0, int show_stats)
+{
+    static const char *names[] = { "test_atomic_exp", "test_atomic_exp(too small)" } ;
+    for (int small = 0 ; small < 2 ; small++ ) {
+        double start_t = time_mono() ;
+        IhtAtomicCache c = ihtAtomicCacheCreate(small ? N/2 : N, atomic_exp_wrapper, NULL) ;
+        pthread_t threads[T] ;
+        struct atomic_work work[T] ;
+        for (int t = 0 ; t < T ; t++ ) {
+            work[t] = (struct atomic_work) { .cache = c, .thread = t, .n_threads = T, .N = N, .R = R } ;
+            (void) pthread_create(&threads[t], NULL, run_atomic, &work[t]) ;
+        }
+        double s = 0 ;
+        for (int t = 0 ; t < T ; t++ ) {
+            (void) pthread_join(threads[t], NULL) ;
+            s += work[t].sum ;
+            if ( work[t].errors ) {
+                (void) fprintf(stderr, "FAILED: %s: thread %d: %d wrong values\n", names[small], t, work[t].errors) ;
+                error_count++ ;
+            }
+        }
+        double end_t = time_mono() ;
+        check_test(names[small], end_t - start_t, s0, s/R/N) ;
+        if ( show_stats ) ihtAtomicCachePrintStats(stdout, c, names[small], 2, show_stats) ;
+        ihtAtomicCacheDestroy(c) ;
+    }
+}
+
+// Linearizability stress test. Phase 1: each writer owns KEYS keys, and numbers its
+// operations on a key: operation n puts value n, or removes the key (every 5th). The
+// writer publishes the number of the operation it started and of the last one done.
+// A value n seen by a reader must be a put, not older than the last operation done
+// before the lookup, not newer than the last one started after it, and not older than
+// a value the reader saw before (no new-old inversion). Lookups may miss (evictions).
+// Phase 2: all threads put the same keys, values must always belong to their key.
+#define STRESS_KEYS 64
+
+struct stress_shared {
+    IhtAtomicCache cache ;
+    int n_writers ;
+    int n_threads ;
+    int64_t ops ;
+    uint64_t *started ;         // [n_writers * STRESS_KEYS]
+    uint64_t *done ;
+    int stop ;
+} ;
+
+struct stress_work {
+    struct stress_shared *shared ;
+    int thread ;
+    int64_t errors ;
+    int64_t found ;
+} ;
+
+static inline IhtCacheFastKey stress_key(int id)
+{
+    return (IhtCacheFastKey) { .v0 = (uint64_t) id * 0x9e3779b97f4a7c15ULL, .v1 = (uint64_t) id } ;
+}
+
+static void *run_stress_writer(void *arg)
+{
+    struct stress_work *work = arg ;
+    struct stress_shared *sh = work->shared ;
+    uint64_t seq[STRESS_KEYS] = { 0 } ;
+    unsigned rnd = work->thread + 1 ;
+    for (int64_t op = 0 ; op < sh->ops ; op++ ) {
+        rnd = rnd * 1103515245 + 12345 ;
+        int j = (rnd >> 8) % STRESS_KEYS ;
+        int id = work->thread * STRESS_KEYS + j ;
+        IhtCacheFastKey key = stress_key(id) ;
+        uint64_t n = ++seq[j] ;
+        __atomic_store_n(&sh->started[id], n, __ATOMIC_SEQ_CST) ;
+        if ( n % 5 == 0 ) {
+            (void) ihtAtomicCacheRemove(sh->cache, key) ;
+        } else {
+            (void) ihtAtomicCachePut(sh->cache, key, (IhtCacheFastValue) { .v0 = n, .v1 = (uint64_t) id }) ;
+        }
+        __atomic_store_n(&sh->done[id], n, __ATOMIC_SEQ_CST) ;
+        // No other thread writes the key: the writer reads its own write, or a miss
+        IhtCacheFastValue value ;
+        if ( ihtAtomicCacheLookup(sh->cache, key, &value) && (n % 5 == 0 || value.v0 != n || value.v1 != (uint64_t) id) ) work->errors++ ;
+    }
+    return NULL ;
+}
+
+static void *run_stress_reader(void *arg)
+{
+    struct stress_work *work = arg ;
+    struct stress_shared *sh = work->shared ;
+    int n_keys = sh->n_writers * STRESS_KEYS ;
+    uint64_t *last_seen = calloc(n_keys, sizeof(uint64_t)) ;
+    unsigned rnd = work->thread + 1 ;
+    while ( !__atomic_load_n(&sh->stop, __ATOMIC_ACQUIRE) ) {
+        rnd = rnd * 1103515245 + 12345 ;
+        int id = (int) ((rnd >> 8) % n_keys) ;
+        uint64_t done = __atomic_load_n(&sh->done[id], __ATOMIC_SEQ_CST) ;
+        IhtCacheFastValue value ;
+        bool found = ihtAtomicCacheLookup(sh->cache, stress_key(id), &value) ;
+        uint64_t started = __atomic_load_n(&sh->started[id], __ATOMIC_SEQ_CST) ;
+        if ( !found ) continue ;
+        work->found++ ;
+        uint64_t n = value.v0 ;
+        if ( value.v1 != (uint64_t) id || n % 5 == 0 || n < done || n > started || n < last_seen[id] ) {
+            if ( work->errors++ < 5 ) {
+                (void) fprintf(stderr, "FAILED: key %d: value %" PRIu64 " (key %" PRIu64 "), done %" PRIu64 ", started %" PRIu64 ", seen %" PRIu64 "\n",
+                    id, n, value.v1, done, started, last_seen[id]) ;
+            }
+        }
+        last_seen[id] = n ;
+    }
+    free(last_seen) ;
+    return NULL ;
+}
+
+static void *run_stress_shared(void *arg)
+{
+    struct stress_work *work = arg ;
+    struct stress_shared *sh = work->shared ;
+    unsigned rnd = work->thread + 1 ;
+    for (int64_t op = 0 ; op < sh->ops ; op++ ) {
+        rnd = rnd * 1103515245 + 12345 ;
+        int id = (int) ((rnd >> 8) % STRESS_KEYS) ;
+        IhtCacheFastKey key = stress_key(id) ;
+        IhtCacheFastValue value ;
+        switch ( (rnd >> 24) % 4 ) {
+            case 0:
+                (void) ihtAtomicCacheRemove(sh->cache, key) ;
+                break ;
+            case 1:
+                (void) ihtAtomicCachePut(sh->cache, key, (IhtCacheFastValue) { .v0 = (uint64_t) work->thread, .v1 = (uint64_t) id }) ;
+                break ;
+            default:
+                if ( ihtAtomicCacheLookup(sh->cache, key, &value) ) {
+                    work->found++ ;
+                    if ( value.v1 != (uint64_t) id || value.v0 >= (uint64_t) sh->n_threads ) work->errors++ ;
+                }
+        }
+    }
+    return NULL ;
+}
+
+void test_atomic_stress(int N, int R, int T, double s0, int show_stats)
+{
+    (void) s0 ;
+    static const char *names[] = { "test_atomic_stress(owned keys)", "test_atomic_stress(owned keys, too small)", "test_atomic_stress(shared keys)" } ;
+    int n_writers = T > 1 ? T/2 : 1 ;
+    int n_readers = T > 1 ? T - n_writers : 1 ;
+    for (int phase = 0 ; phase < 3 ; phase++ ) {
+        double start_t = time_mono() ;
+        int n_keys = n_writers * STRESS_KEYS ;
+        struct stress_shared sh = {
+            .cache = ihtAtomicCacheCreate(phase == 1 ? n_keys/4 : 2*n_keys, NULL, NULL),
+            .n_writers = n_writers,
+            .n_threads = n_writers + n_readers,
+            .ops = (int64_t) N * R / (n_writers + n_readers),
+            .started = calloc(n_keys, sizeof(uint64_t)),
+            .done = calloc(n_keys, sizeof(uint64_t)),
+        } ;
+        int n_threads = n_writers + n_readers ;
+        pthread_t threads[n_threads] ;
+        struct stress_work work[n_threads] ;
+        for (int t = 0 ; t < n_threads ; t++ ) {
+            work[t] = (struct stress_work) { .shared = &sh, .thread = t < n_writers ? t : t - n_writers } ;
+            void *(*run)(void *) = phase == 2 ? run_stress_shared : t < n_writers ? run_stress_writer : run_stress_reader ;
+            if ( phase == 2 ) work[t].thread = t ;
+            (void) pthread_create(&threads[t], NULL, run, &work[t]) ;
+        }
+        int64_t errors = 0, found = 0 ;
+        for (int t = 0 ; t < n_threads ; t++ ) {
+            if ( t == n_writers && phase != 2 ) __atomic_store_n(&sh.stop, 1, __ATOMIC_RELEASE) ;
+            (void) pthread_join(threads[t], NULL) ;
+            errors += work[t].errors ;
+            found += work[t].found ;
+        }
+        double end_t = time_mono() ;
+        (void) fprintf(stderr, "%s (%.3f seconds): %" PRId64 " values checked, %" PRId64 " errors\n", names[phase], end_t - start_t, found, errors) ;
+        if ( errors || !found ) {
+            (void) fprintf(stderr, "FAILED: %s\n", names[phase]) ;
+            error_count++ ;
+        }
+        if ( show_stats ) ihtAtomicCachePrintStats(stdout, sh.cache, names[phase], 2, show_stats) ;
+        ihtAtomicCacheDestroy(sh.cache) ;
+        free(sh.started) ;
+        free(sh.done) ;
+    }
+}
+
+// Single-flight fills: all threads fetch the same keys, in the same order, with a filler
+// taking a millisecond. Each key must be filled once, and every fetch must get the value
+// of the fill; fills of every 8th key fail, and all the fetches waiting for them fail.
+#define FLIGHT_KEYS 32
+
+struct flight_shared {
+    IhtAtomicCache cache ;
+    pthread_barrier_t start ;
+    int fills[FLIGHT_KEYS] ;
+} ;
+
+struct flight_work {
+    struct flight_shared *shared ;
+    int errors ;
+} ;
+
+static bool slow_filler(void *cxt, const void *param, void *result)
+{
+    struct flight_shared *sh = cxt ;
+    IhtCacheFastKey key = *(const IhtCacheFastKey *) param ;
+    __atomic_add_fetch(&sh->fills[key.v1], 1, __ATOMIC_RELAXED) ;
+    (void) nanosleep(&(struct timespec) { .tv_nsec = 1000000 }, NULL) ;
+    *(IhtCacheFastValue *) result = (IhtCacheFastValue) { .v0 = key.v1 * 3, .v1 = key.v1 } ;
+    return key.v1 % 8 != 7 ;
+}
+
+static void *run_flight(void *arg)
+{
+    struct flight_work *work = arg ;
+    struct flight_shared *sh = work->shared ;
+    (void) pthread_barrier_wait(&sh->start) ;
+    for (int id = 0 ; id < FLIGHT_KEYS ; id++ ) {
+        IhtCacheFastValue value = { 0 } ;
+        bool found = ihtAtomicCacheFetch(sh->cache, stress_key(id), &value) ;
+        if ( id % 8 == 7 ? found : !found || value.v0 != (uint64_t) id * 3 || value.v1 != (uint64_t) id ) work->errors++ ;
+    }
+    return NULL ;
+}
+
+void test_atomic_single_flight(int N, int R, int T, double s0, int show_stats)
+{
+    (void) N ; (void) R ; (void) s0 ;
+    double start_t = time_mono() ;
+    struct flight_shared sh = { 0 } ;
+    sh.cache = ihtAtomicCacheCreate(4*FLIGHT_KEYS, slow_filler, &sh) ;
+    (void) pthread_barrier_init(&sh.start, NULL, T) ;
+    pthread_t threads[T] ;
+    struct flight_work work[T] ;
+    for (int t = 0 ; t < T ; t++ ) {
+        work[t] = (struct flight_work) { .shared = &sh } ;
+        (void) pthread_create(&threads[t], NULL, run_flight, &work[t]) ;
+    }
+    int errors = 0 ;
+    for (int t = 0 ; t < T ; t++ ) {
+        (void) pthread_join(threads[t], NULL) ;
+        errors += work[t].errors ;
+    }
+    int fills = 0 ;
+    for (int id = 0 ; id < FLIGHT_KEYS ; id++ ) {
+        // Failed fills are not cached, later fetches fill again (at most once per thread)
+        if ( id % 8 != 7 ? sh.fills[id] != 1 : sh.fills[id] < 1 || sh.fills[id] > T ) errors++ ;
+        fills += sh.fills[id] ;
+    }
+    struct IhtCacheStats stats ;
+    ihtAtomicCacheGetStats(sh.cache, &stats) ;
+    double end_t = time_mono() ;
+    (void) fprintf(stderr, "%s (%.3f seconds): %d fills, %" PRId64 " shared, %d errors\n", __func__, end_t - start_t, fills, stats.shared_fills, errors) ;
+    // Statistics may be compiled out (IHT_NO_STATS)
+    bool counted = stats.mode != IHT_STATS_NONE ;
+    if ( errors || (counted && (stats.misses.count - stats.shared_fills != fills || (T > 1 && !stats.shared_fills))) ) {
+        (void) fprintf(stderr, "FAILED: %s\n", __func__) ;
+        error_count++ ;
+    }
+    if ( show_stats ) ihtAtomicCachePrintStats(stdout, sh.cache, __func__, 2, show_stats) ;
+    ihtAtomicCacheDestroy(sh.cache) ;
+    (void) pthread_barrier_destroy(&sh.start) ;
+}
+
+// Slow fills in a sharded cache: all threads fetch the same keys of one shard, with a
+// filler taking a millisecond. Each key is filled once, and the threads waiting for
+// the shard lock while the filler runs must sleep: the process CPU time stays well
+// below the elapsed time.
+struct slow_shard_shared {
+    IhtShardedCache cache ;
+    pthread_barrier_t start ;
+    int fills[FLIGHT_KEYS] ;
+} ;
+
+struct slow_shard_work {
+    struct slow_shard_shared *shared ;
+    int errors ;
+} ;
+
+static bool slow_shard_filler(void *cxt, const void *param, void *result)
+{
+    struct slow_shard_shared *sh = cxt ;
+    IhtCacheFastKey key = *(const IhtCacheFastKey *) param ;
+    __atomic_add_fetch(&sh->fills[key.v1], 1, __ATOMIC_RELAXED) ;
+    (void) nanosleep(&(struct timespec) { .tv_nsec = 1000000 }, NULL) ;
+    *(IhtCacheFastValue *) result = (IhtCacheFastValue) { .v0 = key.v1 * 3, .v1 = key.v1 } ;
+    return true ;
+}
+
+static void *run_slow_shard(void *arg)
+{
+    struct slow_shard_work *work = arg ;
+    struct slow_shard_shared *sh = work->shared ;
+    (void) pthread_barrier_wait(&sh->start) ;
+    for (int id = 0 ; id < FLIGHT_KEYS ; id++ ) {
+        IhtCacheFastKey key = stress_key(id) ;
+        IhtCacheFastValue value = { 0 } ;
+        if ( !ihtShardedCacheFetch(sh->cache, &key, &value) || value.v0 != (uint64_t) id * 3 || value.v1 != (uint64_t) id ) work->errors++ ;
+    }
+    return NULL ;
+}
+
+static double cpu_time(void)
+{
+    struct timespec ts ;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) ;
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9 ;
+}
+
+void test_sharded_slow_fills(int N, int R, int T, double s0, int show_stats)
+{
+    (void) N ; (void) R ; (void) s0 ;
+    double start_t = time_mono() ;
+    double start_cpu = cpu_time() ;
+    struct slow_shard_shared sh = { 0 } ;
+    sh.cache = ihtShardedCacheCreate(4*FLIGHT_KEYS, 1, sizeof(IhtCacheFastKey), sizeof(IhtCacheFastValue), slow_shard_filler, &sh) ;
+    (void) pthread_barrier_init(&sh.start, NULL, T) ;
+    pthread_t threads[T] ;
+    struct slow_shard_work work[T] ;
+    for (int t = 0 ; t < T ; t++ ) {
+        work[t] = (struct slow_shard_work) { .shared = &sh } ;
+        (void) pthread_create(&threads[t], NULL, run_slow_shard, &work[t]) ;
+    }
+    int errors = 0 ;
+    for (int t = 0 ; t < T ; t++ ) {
+        (void) pthread_join(threads[t], NULL) ;
+        errors += work[t].errors ;
+    }
+    for (int id = 0 ; id < FLIGHT_KEYS ; id++ ) {
+        if ( sh.fills[id] != 1 ) errors++ ;
+    }
+    double end_t = time_mono() ;
+    double cpu = cpu_time() - start_cpu ;
+    (void) fprintf(stderr, "%s (%.3f seconds): %.3f seconds of CPU, %d errors\n", __func__, end_t - start_t, cpu, errors) ;
+    if ( errors || cpu > 0.5 * (end_t - start_t) ) {
+        (void) fprintf(stderr, "FAILED: %s\n", __func__) ;
+        error_count++ ;
+    }
+    show_test_details(sh.cache, __func__, show_stats) ;
+    ihtShardedCacheDestroy(sh.cache) ;
+    (void) pthread_barrier_destroy(&sh.start) ;
+}
+
+// Throughput by thread count, up to T threads. Scaling depends on the cores available,
+// only the results are checked.
+void test_sharded_scaling(int N, int R, int T, double s0, int show_stats)
+{
+    (void) show_stats ;
+    for (int threads = 1 ; threads <= T ; threads *= 2 ) {
+        IhtShardedCache c = ihtShardedCacheCreate(N, 4*threads, sizeof(double), sizeof(double), exp_wrapper, NULL);
+        double start_t = time_mono() ;
+        double result = run_threads(c, threads, N, R, false) ;
+        double end_t = time_mono() ;
+        char test_name[80] ;
+        (void) snprintf(test_name, sizeof(test_name), "%s(%d threads)", __func__, threads) ;
+        check_test(test_name, end_t - start_t, s0, result) ;
+        (void) fprintf(stderr, "%s: %.1f M lookups/second\n", test_name, (double) N * R / (end_t - start_t + 1e-9) / 1e6) ;
+        ihtShardedCacheDestroy(c) ;
+    }
+}
+
+// Invoke with '-nN', '-rR' and '-pT' to set N, R and the thread count
+// Default
+static bool run_test(int test_id, const char *test_select)
+{
+    return !test_select || strchr(test_select, test_id) ;
+}
+
+
+int main(int argc, char **argv) {
+    int N = 1000 ;
+    int R = 1000 ;
+    int T = 4 ;
+    char *test_select = NULL ;
+    int show_stats = 1 ;
+    int opt ;
+    while ( (opt=getopt(argc, argv, "qsn:r:p:t:")) != -1 ) {
+        switch ( opt ) {
+            case 'n':
+                N = atoi(optarg) ;
+                break ;
+            case 'r':
+                R = atoi(optarg) ;
+                break ;
+            case 'p':
+                T = atoi(optarg) ;
+                if ( T < 1 ) T = 1 ;
+                break ;
+            case 'q':
+                show_stats = 0 ;
+                break ;
+            case 's':
+                show_stats = 2 ;
+                break ;
+            case 't':
+                free(test_select) ;
+                test_select = strdup(optarg) ;
+                break ;
+            default:
+                (void) fprintf(stderr, "Unknown option: %c\n", optopt) ;
+                exit(2) ;
+        }
+    }
+
+    (void) fprintf(stderr, "Test IHT Sharded Cache (N=%d,R=%d,T=%d)\n", N, R, T) ;
+    double exp_result = test_exp(N, R) ;
+    if ( run_test('A', test_select) ) test_sharded_exp(N, R, T, exp_result, show_stats) ;
+    if ( run_test('B', test_select) ) test_sharded_too_small(N, R, T, exp_result, show_stats) ;
+    if ( run_test('C', test_select) ) test_sharded_generic(N, R, T, exp_result, show_stats) ;
+    if ( run_test('D', test_select) ) test_sharded_scaling(N, R, T, exp_result, show_stats) ;
+    if ( run_test('E', test_select) ) test_sharded_optimistic(N, R, T, exp_result, show_stats) ;
+    if ( run_test('F', test_select) ) test_atomic_exp(N, R, T, exp_result, show_stats) ;
+    if ( run_test('G', test_select) ) test_atomic_stress(N, R, T, exp_result, show_stats) ;
+    if ( run_test('H', test_select) ) test_atomic_single_flight(N, R, T, exp_result, show_stats) ;
+    if ( run_test('I', test_select) ) test_sharded_slow_fills(N, R, T, exp_result, show_stats) ;
+    free(test_select) ;
+    return error_count ? EXIT_FAILURE : EXIT_SUCCESS ;
+}